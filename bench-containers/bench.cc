@@ -0,0 +1,261 @@
+/******************************************************************************
+ * bench-containers/bench.cc
+ *
+ * Memory efficiency of standard and custom containers: bytes and allocations
+ * per element, peak during growth and time per insert, for several element
+ * sizes and counts, as tables and memory profiles.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include "memprofile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <new>
+#include <vector>
+#include <deque>
+#include <list>
+#include <set>
+#include <map>
+#include <string>
+#include <tr1/unordered_map>
+
+/// largest bytes of elements filled into one container
+static const size_t max_fill_bytes = 256 * 1024 * 1024;
+
+/// small fills are repeated until this many elements were inserted
+static const size_t min_inserts = 1000000;
+
+/// element count filled into the profiled containers
+static size_t profile_count = 1000000;
+
+/// element size of the profiled containers
+static const size_t profile_size = 16;
+
+/// table of results, as read by containers.gnuplot
+static FILE* table = NULL;
+
+/// monotonic wall time in seconds
+static double timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// element of Size bytes with an unsigned key, Size must be at least 8
+template <size_t Size>
+struct Element
+{
+    unsigned int key;
+    char pad[Size - sizeof(unsigned int)];
+
+    explicit Element(unsigned int k = 0) : key(k) { }
+
+    bool operator < (const Element& o) const { return key < o.key; }
+};
+
+/// keys in scrambled order, Knuth's multiplicative hash is a bijection
+static inline unsigned int make_key(size_t i)
+{
+    return (unsigned int)i * 2654435761u;
+}
+
+/******************************************************************************
+ * Insertion into each container. To measure a custom container, add an
+ * overload of bench_insert() for it and a run_container() call to
+ * run_element_size() below.
+ */
+
+template <typename T>
+void bench_insert(std::vector<T>& c, const T& e) { c.push_back(e); }
+
+template <typename T>
+void bench_insert(std::deque<T>& c, const T& e) { c.push_back(e); }
+
+template <typename T>
+void bench_insert(std::list<T>& c, const T& e) { c.push_back(e); }
+
+template <typename T>
+void bench_insert(std::set<T>& c, const T& e) { c.insert(e); }
+
+template <typename T>
+void bench_insert(std::map<unsigned int, T>& c, const T& e)
+{
+    c.insert(std::make_pair(e.key, e));
+}
+
+template <typename T>
+void bench_insert(std::tr1::unordered_map<unsigned int, T>& c, const T& e)
+{
+    c.insert(std::make_pair(e.key, e));
+}
+
+/**
+ * Example of a custom container: a vector of fixed-size chunks, which never
+ * copies elements and thus avoids the growth peak of std::vector.
+ */
+template <typename T>
+class ChunkedVector
+{
+protected:
+    static const size_t chunk_bytes = 4096;
+    static const size_t per_chunk =
+        sizeof(T) < chunk_bytes ? chunk_bytes / sizeof(T) : 1;
+
+    std::vector<T*> m_chunks;
+    size_t m_size;
+
+public:
+    ChunkedVector() : m_size(0) { }
+
+    ~ChunkedVector()
+    {
+        for (size_t i = 0; i < m_chunks.size(); ++i)
+            free(m_chunks[i]);
+    }
+
+    void push_back(const T& e)
+    {
+        if (m_size == m_chunks.size() * per_chunk)
+            m_chunks.push_back((T*)malloc(per_chunk * sizeof(T)));
+        new (m_chunks.back() + m_size % per_chunk) T(e);
+        ++m_size;
+    }
+
+    size_t size() const { return m_size; }
+};
+
+template <typename T>
+void bench_insert(ChunkedVector<T>& c, const T& e) { c.push_back(e); }
+
+/******************************************************************************
+ * Measurement harness
+ */
+
+/// fill a container with n elements and print one line of the table. Small
+/// fills are repeated and the fastest one is taken as time per insert.
+template <typename Container, typename T>
+void run_container(const char* name, size_t n)
+{
+    size_t base = malloc_count_current();
+    size_t allocs = malloc_count_num_allocs();
+    malloc_count_reset_peak();
+
+    size_t bytes = 0, peak = 0, num = 0;
+    size_t reps = n < min_inserts ? min_inserts / n : 1;
+    double elapsed = 0;
+
+    for (size_t r = 0; r < reps; ++r)
+    {
+        Container c;
+        double ts = timestamp();
+        for (size_t i = 0; i < n; ++i)
+            bench_insert(c, T(make_key(i)));
+        ts = timestamp() - ts;
+        if (r == 0 || ts < elapsed) elapsed = ts;
+
+        if (r == 0) {
+            bytes = malloc_count_current() - base;
+            peak = malloc_count_peak() - base;
+            num = malloc_count_num_allocs() - allocs;
+        }
+    }
+
+    char line[256];
+    sprintf(line, "%-16s %6lu %9lu %10.2f %8.3f %10.2f %9.3f %9.2f\n",
+            name, (unsigned long)sizeof(T), (unsigned long)n,
+            (double)bytes / n, (double)bytes / n / sizeof(T),
+            (double)peak / n, (double)num / n, elapsed / n * 1e9);
+    fputs(line, stdout);
+    if (table) fputs(line, table);
+}
+
+/// fill a container under MemProfile, writing profile-<name>.txt
+template <typename Container, typename T>
+void profile_container(const char* name, size_t n)
+{
+    std::string path = std::string("profile-") + name + ".txt";
+    MemProfile mp(path.c_str(), 0.001, n * sizeof(T) / 200 + 1024);
+
+    Container c;
+    for (size_t i = 0; i < n; ++i)
+        bench_insert(c, T(make_key(i)));
+}
+
+/// run and profile a container type for one element type and all counts
+template <typename Container, typename T>
+void run_container(const char* name, const std::vector<size_t>& counts)
+{
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] * sizeof(T) > max_fill_bytes) continue;
+        run_container<Container, T>(name, counts[i]);
+    }
+
+    if (sizeof(T) == profile_size)
+        profile_container<Container, T>(name, profile_count);
+}
+
+template <typename T>
+void run_element_size(const std::vector<size_t>& counts)
+{
+    run_container<std::vector<T>, T>("vector", counts);
+    run_container<std::deque<T>, T>("deque", counts);
+    run_container<std::list<T>, T>("list", counts);
+    run_container<std::set<T>, T>("set", counts);
+    run_container<std::map<unsigned int, T>, T>("map", counts);
+    run_container<std::tr1::unordered_map<unsigned int, T>, T>(
+        "unordered_map", counts);
+    run_container<ChunkedVector<T>, T>("chunked_vector", counts);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<size_t> counts;
+    for (int i = 1; i < argc; ++i) {
+        if (atol(argv[i]) > 0) counts.push_back(atol(argv[i]));
+    }
+    if (counts.empty()) {
+        counts.push_back(1000);
+        counts.push_back(100000);
+        counts.push_back(1000000);
+    }
+    profile_count = counts.back();
+
+    table = fopen("containers.txt", "w");
+
+    char line[256];
+    sprintf(line, "%-16s %6s %9s %10s %8s %10s %9s %9s\n",
+            "#container", "elem", "count", "bytes/el", "overhead",
+            "peak/el", "allocs/el", "ns/insert");
+    fputs(line, stdout);
+    if (table) fputs(line, table);
+
+    run_element_size< Element<8> >(counts);
+    run_element_size< Element<16> >(counts);
+    run_element_size< Element<64> >(counts);
+    run_element_size< Element<256> >(counts);
+
+    if (table) fclose(table);
+
+    return 0;
+}
+
+/*****************************************************************************/
@@ -0,0 +1,46 @@
+#!/usr/bin/env gnuplot
+
+set terminal pdf size 28cm,18cm linewidth 2.0
+set output "containers.pdf"
+
+set key top left
+set grid xtics ytics
+
+set title 'Memory Profile of Container Fills with 16 Byte Elements'
+set xlabel 'Time [s]'
+set ylabel 'Memory Usage [MiB]'
+
+plot \
+    'profile-vector.txt' using 1:($2 / 1024/1024) title 'vector' with lines, \
+    'profile-deque.txt' using 1:($2 / 1024/1024) title 'deque' with lines, \
+    'profile-list.txt' using 1:($2 / 1024/1024) title 'list' with lines, \
+    'profile-set.txt' using 1:($2 / 1024/1024) title 'set' with lines, \
+    'profile-map.txt' using 1:($2 / 1024/1024) title 'map' with lines, \
+    'profile-unordered_map.txt' using 1:($2 / 1024/1024) \
+        title 'unordered_map' with lines, \
+    'profile-chunked_vector.txt' using 1:($2 / 1024/1024) \
+        title 'chunked_vector' with lines
+
+set title 'Heap Bytes per Byte of Element Data, Largest Count'
+set xlabel 'Element Size [B]'
+set ylabel 'Overhead Factor'
+set logscale x 2
+set key top right
+
+# only rows of the largest count of each element size
+count(c) = (column(3) == c ? column(5) : 1/0)
+stats 'containers.txt' using 3 nooutput
+maxcount = STATS_max
+
+row(name) = (strcol(1) eq name ? count(maxcount) : 1/0)
+
+plot \
+    'containers.txt' using 2:(row("vector")) title 'vector' with linespoints, \
+    'containers.txt' using 2:(row("deque")) title 'deque' with linespoints, \
+    'containers.txt' using 2:(row("list")) title 'list' with linespoints, \
+    'containers.txt' using 2:(row("set")) title 'set' with linespoints, \
+    'containers.txt' using 2:(row("map")) title 'map' with linespoints, \
+    'containers.txt' using 2:(row("unordered_map")) \
+        title 'unordered_map' with linespoints, \
+    'containers.txt' using 2:(row("chunked_vector")) \
+        title 'chunked_vector' with linespoints
@@ -0,0 +1,596 @@
+/******************************************************************************
+ * bench-malloc_count/bench.cc
+ *
+ * Macro benchmark suite of allocator stress workloads, which is linked once
+ * without and several times with differently configured malloc_count objects
+ * to measure the cost of each instrumentation mode.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <vector>
+#include <deque>
+#include <list>
+#include <set>
+#include <map>
+#include <string>
+
+/// number of threads of the multi-threaded workloads
+static const unsigned int num_threads = 4;
+
+/// global scale factor of all workloads, set from the command line
+static unsigned int scale = 1;
+
+/// monotonic wall time in seconds
+static double timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// small and fast xorshift random generator, one per thread
+struct Random
+{
+    unsigned long long state;
+
+    explicit Random(unsigned long long seed)
+        : state(seed * 0x9E3779B97F4A7C15ULL + 1) { }
+
+    unsigned long long next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    /// random allocation size in [lo,hi), skewed towards small sizes
+    size_t size(size_t lo, size_t hi)
+    {
+        size_t range = hi - lo;
+        return lo + (next() % range) * (next() % range) / range;
+    }
+};
+
+/// result of one workload: number of allocator operations and requested peak
+struct Result
+{
+    unsigned long long ops;
+    unsigned long long peak_bytes;
+};
+
+/// tracks requested live bytes of a workload from multiple threads
+struct LiveBytes
+{
+    long long curr, peak;
+
+    LiveBytes() : curr(0), peak(0) { }
+
+    void add(long long inc)
+    {
+        long long mycurr = __sync_add_and_fetch(&curr, inc), mypeak;
+        while ((mypeak = peak) < mycurr &&
+               !__sync_bool_compare_and_swap(&peak, mypeak, mycurr)) { }
+    }
+};
+
+/******************************************************************************
+ * larson: server-style churn, each thread frees and replaces random slots of
+ * an object array, which is handed to the next thread after each round.
+ */
+
+struct LarsonArgs
+{
+    std::vector<void*>* slots;
+    std::vector<size_t>* sizes;
+    unsigned int        seed;
+    unsigned long long  ops;
+    LiveBytes*          live;
+};
+
+static void* larson_thread(void* arg)
+{
+    LarsonArgs* a = static_cast<LarsonArgs*>(arg);
+    Random rng(a->seed);
+    std::vector<void*>& slots = *a->slots;
+    std::vector<size_t>& sizes = *a->sizes;
+
+    for (unsigned long long i = 0; i < a->ops; ++i)
+    {
+        size_t k = rng.next() % slots.size();
+        free(slots[k]);
+        a->live->add(-(long long)sizes[k]);
+
+        sizes[k] = rng.size(16, 1024);
+        slots[k] = malloc(sizes[k]);
+        a->live->add(sizes[k]);
+    }
+    return NULL;
+}
+
+static Result run_larson()
+{
+    const size_t num_slots = 4096;
+    const unsigned int rounds = 10;
+    const unsigned long long ops = 100000 * scale;
+
+    std::vector< std::vector<void*> > slots(num_threads);
+    std::vector< std::vector<size_t> > sizes(num_threads);
+    LiveBytes live;
+    Result res = { 0, 0 };
+
+    Random rng(1);
+    for (unsigned int t = 0; t < num_threads; ++t) {
+        slots[t].resize(num_slots);
+        sizes[t].resize(num_slots);
+        for (size_t i = 0; i < num_slots; ++i) {
+            sizes[t][i] = rng.size(16, 1024);
+            slots[t][i] = malloc(sizes[t][i]);
+            live.add(sizes[t][i]);
+        }
+    }
+
+    for (unsigned int r = 0; r < rounds; ++r)
+    {
+        pthread_t threads[num_threads];
+        LarsonArgs args[num_threads];
+
+        for (unsigned int t = 0; t < num_threads; ++t) {
+            // hand the array of thread t to thread t+r: cross-thread frees
+            args[t].slots = &slots[(t + r) % num_threads];
+            args[t].sizes = &sizes[(t + r) % num_threads];
+            args[t].seed = r * num_threads + t + 1;
+            args[t].ops = ops / rounds;
+            args[t].live = &live;
+            pthread_create(&threads[t], NULL, larson_thread, &args[t]);
+        }
+        for (unsigned int t = 0; t < num_threads; ++t) {
+            pthread_join(threads[t], NULL);
+            res.ops += 2 * args[t].ops;
+        }
+    }
+
+    for (unsigned int t = 0; t < num_threads; ++t) {
+        for (size_t i = 0; i < num_slots; ++i)
+            free(slots[t][i]);
+        res.ops += 2 * num_slots;
+    }
+
+    res.peak_bytes = live.peak;
+    return res;
+}
+
+/******************************************************************************
+ * prodcons and xmalloc: producers allocate objects or batches of objects,
+ * which are passed through a bounded queue to consumers which free them.
+ */
+
+struct Queue
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    std::deque<void*> items;
+    size_t          capacity;
+    unsigned int    producers;  ///< number of producers still running
+
+    Queue(size_t cap, unsigned int prod)
+        : capacity(cap), producers(prod)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&cond, NULL);
+    }
+
+    ~Queue()
+    {
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void push(void* p)
+    {
+        pthread_mutex_lock(&mutex);
+        while (items.size() >= capacity)
+            pthread_cond_wait(&cond, &mutex);
+        items.push_back(p);
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    /// returns NULL if all producers are done and the queue is empty
+    void* pop()
+    {
+        pthread_mutex_lock(&mutex);
+        while (items.empty() && producers != 0)
+            pthread_cond_wait(&cond, &mutex);
+        void* p = NULL;
+        if (!items.empty()) {
+            p = items.front();
+            items.pop_front();
+        }
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+        return p;
+    }
+
+    void producer_done()
+    {
+        pthread_mutex_lock(&mutex);
+        --producers;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+struct ProdConsArgs
+{
+    Queue*              queue;
+    unsigned int        seed;
+    unsigned long long  items;
+    size_t              batch;  ///< objects per queue item, 0 = single object
+    LiveBytes*          live;
+};
+
+/// a batch of objects as passed through the queue by the xmalloc workload
+struct Batch
+{
+    size_t  num;
+    size_t  bytes;
+    void*   objs[1];
+};
+
+static void* producer_thread(void* arg)
+{
+    ProdConsArgs* a = static_cast<ProdConsArgs*>(arg);
+    Random rng(a->seed);
+
+    for (unsigned long long i = 0; i < a->items; ++i)
+    {
+        if (a->batch == 0) {
+            size_t size = rng.size(sizeof(size_t), 512);
+            size_t* p = static_cast<size_t*>(malloc(size));
+            *p = size;
+            a->live->add(size);
+            a->queue->push(p);
+        }
+        else {
+            Batch* b = static_cast<Batch*>(
+                malloc(sizeof(Batch) + (a->batch - 1) * sizeof(void*)));
+            b->num = a->batch;
+            b->bytes = 0;
+            for (size_t j = 0; j < b->num; ++j) {
+                size_t size = rng.size(16, 256);
+                b->objs[j] = malloc(size);
+                b->bytes += size;
+            }
+            a->live->add(b->bytes);
+            a->queue->push(b);
+        }
+    }
+    a->queue->producer_done();
+    return NULL;
+}
+
+static void* consumer_thread(void* arg)
+{
+    ProdConsArgs* a = static_cast<ProdConsArgs*>(arg);
+
+    while (void* p = a->queue->pop())
+    {
+        if (a->batch == 0) {
+            a->live->add(-(long long)*static_cast<size_t*>(p));
+            free(p);
+        }
+        else {
+            Batch* b = static_cast<Batch*>(p);
+            for (size_t j = 0; j < b->num; ++j)
+                free(b->objs[j]);
+            a->live->add(-(long long)b->bytes);
+            free(b);
+        }
+    }
+    return NULL;
+}
+
+static Result run_prodcons(size_t batch)
+{
+    const unsigned int num_prod = num_threads / 2, num_cons = num_threads / 2;
+    const unsigned long long items =
+        (batch ? 2000 : 200000) * (unsigned long long)scale;
+
+    Queue queue(1024, num_prod);
+    LiveBytes live;
+    pthread_t threads[num_threads];
+    ProdConsArgs args[num_threads];
+
+    for (unsigned int t = 0; t < num_prod + num_cons; ++t) {
+        args[t].queue = &queue;
+        args[t].seed = t + 1;
+        args[t].items = items / num_prod;
+        args[t].batch = batch;
+        args[t].live = &live;
+        pthread_create(&threads[t], NULL,
+                       t < num_prod ? producer_thread : consumer_thread,
+                       &args[t]);
+    }
+    for (unsigned int t = 0; t < num_prod + num_cons; ++t)
+        pthread_join(threads[t], NULL);
+
+    Result res;
+    res.ops = 2 * items * (batch ? batch + 1 : 1);
+    res.peak_bytes = live.peak;
+    return res;
+}
+
+static Result run_producer_consumer()
+{
+    return run_prodcons(0);
+}
+
+static Result run_xmalloc()
+{
+    return run_prodcons(256);
+}
+
+/******************************************************************************
+ * stl: fills of standard containers, like test-memprofile/test.cc. Here the
+ * operations counted are element insertions, not allocator calls.
+ */
+
+static Result run_stl()
+{
+    const size_t n = 200000 * scale;
+    Result res = { 0, 0 };
+
+    {
+        std::vector<int> v;
+        for (size_t i = 0; i < 10 * n; ++i)
+            v.push_back(i);
+        res.peak_bytes = v.capacity() * sizeof(int);
+        res.ops += 10 * n;
+    }
+    {
+        std::set<int> s;
+        for (size_t i = 0; i < n; ++i)
+            s.insert(i);
+        res.ops += n;
+    }
+    {
+        std::map<std::string, int> m;
+        char key[32];
+        for (size_t i = 0; i < n; ++i) {
+            snprintf(key, sizeof(key), "key-%lu-with-some-length",
+                     (unsigned long)i);
+            m[key] = i;
+        }
+        res.ops += n;
+    }
+    {
+        std::list<int> l;
+        for (size_t i = 0; i < n; ++i)
+            l.push_back(i);
+        res.ops += n;
+    }
+    {
+        std::deque<int> d;
+        for (size_t i = 0; i < 10 * n; ++i)
+            d.push_back(i);
+        res.ops += 10 * n;
+    }
+
+    return res;
+}
+
+/******************************************************************************
+ * frag: fragmentation-heavy mix of sizes, where randomly chosen objects are
+ * freed and replaced by larger ones over several phases.
+ */
+
+static Result run_frag()
+{
+    const size_t num = 50000 * scale;
+    const unsigned int phases = 8;
+
+    std::vector<void*> ptrs(num, (void*)NULL);
+    std::vector<size_t> sizes(num, 0);
+    LiveBytes live;
+    Random rng(42);
+    Result res = { 0, 0 };
+
+    for (unsigned int p = 0; p < phases; ++p)
+    {
+        size_t maxsize = (size_t)64 << p;
+        for (size_t i = 0; i < num; ++i)
+        {
+            // free about half of the objects, replace them by larger ones
+            if (ptrs[i] && (rng.next() & 1)) continue;
+            if (ptrs[i]) {
+                free(ptrs[i]);
+                live.add(-(long long)sizes[i]);
+                ++res.ops;
+            }
+            sizes[i] = rng.size(8, maxsize);
+            ptrs[i] = malloc(sizes[i]);
+            live.add(sizes[i]);
+            ++res.ops;
+        }
+    }
+
+    for (size_t i = 0; i < num; ++i) {
+        free(ptrs[i]);
+        ++res.ops;
+    }
+
+    res.peak_bytes = live.peak;
+    return res;
+}
+
+/******************************************************************************
+ * grow: buffers grown by small steps with realloc(), like string builders in
+ * C code, of which a random one is freed and started anew.
+ */
+
+static Result run_grow()
+{
+    const size_t num = 256;
+    const size_t steps = 4000 * scale;
+
+    std::vector<char*> bufs(num, (char*)NULL);
+    std::vector<size_t> sizes(num, 0);
+    LiveBytes live;
+    Random rng(7);
+    Result res = { 0, 0 };
+
+    for (size_t s = 0; s < steps; ++s)
+    {
+        for (size_t i = 0; i < num; ++i)
+        {
+            size_t inc = 16 + rng.next() % 48;
+            bufs[i] = (char*)realloc(bufs[i], sizes[i] + inc);
+            memset(bufs[i] + sizes[i], 1, inc);
+            sizes[i] += inc;
+            live.add(inc);
+            ++res.ops;
+        }
+
+        size_t k = rng.next() % num;
+        free(bufs[k]);
+        live.add(-(long long)sizes[k]);
+        bufs[k] = NULL, sizes[k] = 0;
+        ++res.ops;
+    }
+
+    for (size_t i = 0; i < num; ++i) {
+        free(bufs[i]);
+        ++res.ops;
+    }
+
+    res.peak_bytes = live.peak;
+    return res;
+}
+
+/*****************************************************************************/
+
+struct Workload
+{
+    const char* name;
+    Result (*run)();
+    bool threaded;              ///< runs num_threads threads
+};
+
+static const Workload workloads[] = {
+    { "larson", run_larson, true },
+    { "prodcons", run_producer_consumer, true },
+    { "xmalloc", run_xmalloc, true },
+    { "stl", run_stl, false },
+    { "frag", run_frag, false },
+    { "grow", run_grow, false },
+    { NULL, NULL, false }
+};
+
+/// run a workload in a child process to measure its own maximum RSS
+static void run_workload(const char* variant, const Workload& w)
+{
+    int fds[2];
+    if (pipe(fds) != 0) { perror("pipe"); exit(EXIT_FAILURE); }
+
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); exit(EXIT_FAILURE); }
+
+    if (pid == 0)
+    {
+        double ts = timestamp();
+        Result res = w.run();
+        double elapsed = timestamp() - ts;
+
+        ssize_t wb = write(fds[1], &res, sizeof(res));
+        wb += write(fds[1], &elapsed, sizeof(elapsed));
+        // run exit handlers, which print malloc_count's report of the child
+        exit(wb == sizeof(res) + sizeof(elapsed) ? 0 : 1);
+    }
+
+    close(fds[1]);
+
+    Result res;
+    double elapsed;
+    bool ok = (read(fds[0], &res, sizeof(res)) == sizeof(res) &&
+               read(fds[0], &elapsed, sizeof(elapsed)) == sizeof(elapsed));
+    close(fds[0]);
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+
+    if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("%-18s %-10s failed\n", variant, w.name);
+        return;
+    }
+
+    unsigned long long maxrss = ru.ru_maxrss; // in KiB
+    printf("%-18s %-10s %12llu %9.3f %9.3f %12llu %12llu %8.2f\n",
+           variant, w.name, res.ops, elapsed, res.ops / elapsed / 1e6,
+           res.peak_bytes / 1024, maxrss,
+           res.peak_bytes ? (double)maxrss * 1024 / res.peak_bytes : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* variant = strrchr(argv[0], '/');
+    variant = variant ? variant + 1 : argv[0];
+
+    // variants which are not thread-safe skip the multi-threaded workloads
+    bool single = (getenv("BENCH_SINGLE_THREADED") != NULL);
+
+    const char* only = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (atoi(argv[i]) > 0) scale = atoi(argv[i]);
+        else only = argv[i];
+    }
+
+    if (getenv("BENCH_HEADER")) {
+        printf("%-18s %-10s %12s %9s %9s %12s %12s %8s\n",
+               "variant", "workload", "ops", "seconds", "Mops/s",
+               "peak_KiB", "maxrss_KiB", "overhead");
+    }
+    fflush(stdout);
+
+    for (const Workload* w = workloads; w->name; ++w)
+    {
+        if (only && strcmp(only, w->name) != 0) continue;
+        if (single && w->threaded) continue;
+        run_workload(variant, *w);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
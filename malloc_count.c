@@ -31,7 +31,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <locale.h>
+#include <time.h>
 #include <dlfcn.h>
+#include <errno.h>
 
 #include "malloc_count.h"
 
@@ -41,133 +43,3351 @@ static const int log_operations = 0;    /* <-- set this to 1 for log output */
 static const size_t log_operations_threshold = 1024*1024;
 
 /* option to use gcc's intrinsics to do thread-safe statistics operations */
+#ifndef THREAD_SAFE_GCC_INTRINSICS
 #define THREAD_SAFE_GCC_INTRINSICS      0
+#endif
+
+/* option to register as an OpenMP tool (OMPT) and attribute allocations to the
+ * parallel regions they are made in. Requires omp-tools.h (which is not C89,
+ * compile with -std=gnu99) and a runtime implementing OMPT, e.g. LLVM's
+ * libomp. */
+#ifndef MALLOC_COUNT_OMPT
+#define MALLOC_COUNT_OMPT               0
+#endif
+
+/* option to measure the overhead of malloc_count itself: the time spent in
+ * counting, callbacks, logging and the other optional features, the bytes
+ * used by the allocation prefixes, and the size of internal tables. */
+#ifndef MALLOC_COUNT_SELF_PROFILE
+#define MALLOC_COUNT_SELF_PROFILE       0
+#endif
+
+/* option to keep the statistics in per-CPU slots, which threads update without
+ * contention: with restartable sequences (rseq) registered by glibc >= 2.35
+ * on x86_64, otherwise with atomics on the slot of sched_getcpu(). Queries
+ * sum one slot per CPU. The slots are folded into the peak and the value
+ * passed to the callback every MALLOC_COUNT_PERCPU_BATCH bytes allocated or
+ * freed by a thread, and on each query. */
+#ifndef MALLOC_COUNT_PERCPU
+#define MALLOC_COUNT_PERCPU             0
+#endif
+
+/* bytes a thread allocates or frees before it folds the per-CPU slots. The
+ * peak may be under-reported, and the callback may see a value off, by less
+ * than this times the number of allocating threads. 0 folds on each call. */
+#ifndef MALLOC_COUNT_PERCPU_BATCH
+#define MALLOC_COUNT_PERCPU_BATCH       (256 * 1024)
+#endif
+
+/* option to publish all allocation events into per-thread rings in a shared
+ * memory object, from which tools/malloc_count_monitor builds live reports in
+ * a separate process. Requires -lpthread (and -lrt) with older glibc. */
+#ifndef MALLOC_COUNT_STREAM
+#define MALLOC_COUNT_STREAM             0
+#endif
+
+/* option to write all allocation events into the trace file
+ * malloc_count-<pid>.trace, which is read by tools/malloc_count_analyze. */
+#ifndef MALLOC_COUNT_TRACE
+#define MALLOC_COUNT_TRACE              0
+#endif
+
+/* option to keep a table of all live blocks, from which
+ * malloc_count_write_heapmap() writes a map of the heap's occupancy. */
+#ifndef MALLOC_COUNT_LIVE
+#define MALLOC_COUNT_LIVE               0
+#endif
+
+/* option to identify the call site of each allocation by a short backtrace,
+ * which the reports on live blocks are grouped by. Implies MALLOC_COUNT_LIVE,
+ * and costs a backtrace() per allocation. */
+#ifndef MALLOC_COUNT_SITES
+#define MALLOC_COUNT_SITES              0
+#endif
+
+/* option to check with mincore() which pages of large blocks were never
+ * touched, when they are freed and for live blocks at exit or on request.
+ * Implies MALLOC_COUNT_SITES. */
+#ifndef MALLOC_COUNT_UNTOUCHED
+#define MALLOC_COUNT_UNTOUCHED          0
+#endif
+
+/* option to account allocations, bytes, peak live bytes and the time spent in
+ * the allocator per site and per tag, and to report the sites and tags with
+ * the most churn at exit. Implies MALLOC_COUNT_SITES, and reads the clock
+ * twice per allocator call. */
+#ifndef MALLOC_COUNT_CHURN
+#define MALLOC_COUNT_CHURN              0
+#endif
+
+/* option to record for every pairs_sample_every-th allocation of a thread the
+ * call site which frees it, and to report the pairs of allocating and freeing
+ * sites with their counts and bytes at exit. Implies MALLOC_COUNT_SITES. */
+#ifndef MALLOC_COUNT_PAIRS
+#define MALLOC_COUNT_PAIRS              0
+#endif
+
+/* option to report the allocations made before main(), including those
+ * served by the init heap, those between main() and malloc_count_mark_ready(),
+ * and those after it, with their time and top sites. Exports a wrapper of
+ * __libc_start_main() to find the start of main(), which interposes libc's
+ * for the whole program. Implies
+ * MALLOC_COUNT_SITES, and reads the clock twice per allocator call. */
+#ifndef MALLOC_COUNT_PHASES
+#define MALLOC_COUNT_PHASES             0
+#endif
+
+/* option to detect blocks which are grown by realloc() repeatedly, and to
+ * over-allocate them geometrically in the real realloc(), while counting
+ * their requested sizes. Further growths are served from the slack without
+ * copying, which is reported at exit. Needs glibc's malloc_usable_size(). */
+#ifndef MALLOC_COUNT_GROW
+#define MALLOC_COUNT_GROW               0
+#endif
+
+#if MALLOC_COUNT_PAIRS && !MALLOC_COUNT_SITES
+#undef MALLOC_COUNT_SITES
+#define MALLOC_COUNT_SITES              1
+#endif
+
+#if MALLOC_COUNT_CHURN && !MALLOC_COUNT_SITES
+#undef MALLOC_COUNT_SITES
+#define MALLOC_COUNT_SITES              1
+#endif
+
+#if MALLOC_COUNT_UNTOUCHED && !MALLOC_COUNT_SITES
+#undef MALLOC_COUNT_SITES
+#define MALLOC_COUNT_SITES              1
+#endif
+
+#if MALLOC_COUNT_PHASES && !MALLOC_COUNT_SITES
+#undef MALLOC_COUNT_SITES
+#define MALLOC_COUNT_SITES              1
+#endif
+
+#if MALLOC_COUNT_SITES && !MALLOC_COUNT_LIVE
+#undef MALLOC_COUNT_LIVE
+#define MALLOC_COUNT_LIVE               1
+#endif
+
+/* events are generated if any consumer of them is enabled */
+#define MALLOC_COUNT_EVENTS     (MALLOC_COUNT_STREAM || MALLOC_COUNT_TRACE)
+
+/* allocator calls are timed if any consumer of the times is enabled */
+#define MALLOC_COUNT_ALLOC_TIME (MALLOC_COUNT_CHURN || MALLOC_COUNT_PHASES)
+
+/* to each allocation additional data is added for bookkeeping. due to
+ * alignment requirements, we can optionally add more than just one integer. */
+static const size_t alignment = 16; /* bytes (>= sizeof(struct prefix)) */
+
+/* function pointer to the real procedures, loaded using dlsym */
+typedef void* (*malloc_type)(size_t);
+typedef void  (*free_type)(void*);
+typedef void* (*realloc_type)(void*, size_t);
+
+static malloc_type real_malloc = NULL;
+static free_type real_free = NULL;
+static realloc_type real_realloc = NULL;
+
+/* the bookkeeping prefixed to each allocation, packed into two words:
+ *   word0: size (48 bits) | check (16 bits)
+ *   word1: thread (16 bits) | tag (16 bits) | flags (8 bits) | site (24 bits)
+ * the check is a hash of size and block address, and thus also catches
+ * pointers which were not allocated here or blocks which moved. */
+struct prefix {
+    unsigned long long word0, word1;
+};
+
+/* largest allocation which fits into the prefix */
+#define PREFIX_SIZE_MAX         ((1ULL << 48) - 1)
+
+/* flags of a block in its prefix */
+#define PREFIX_FLAG_INIT_HEAP   0x01    /* allocated on the init heap */
+#define PREFIX_FLAG_SAMPLED     0x02    /* sampled for the site pair report */
+#define PREFIX_FLAG_GROWING     0x04    /* grown by realloc() */
+#define PREFIX_FLAG_OVER        0x08    /* holds slack of over-allocation */
+#define PREFIX_FLAG_MOVED       0x10    /* over-allocation moved the block */
+
+/* tag attached to the allocations of the calling thread */
+static __thread unsigned int tag_curr = 0;
+
+static unsigned int prefix_check(const void* block, unsigned long long size)
+{
+    unsigned long long h = size ^ ((unsigned long long)(size_t)block >> 4);
+    return (unsigned int)((h * 0x9E3779B97F4A7C15ULL) >> 48) ^ 0xC0DE;
+}
+
+static void prefix_set_size(void* block, size_t size)
+{
+    struct prefix* p = (struct prefix*)block;
+    p->word0 = (unsigned long long)size
+        | (unsigned long long)prefix_check(block, size) << 48;
+}
+
+static void prefix_write(void* block, size_t size, unsigned int thread,
+                         unsigned int flags, unsigned int site)
+{
+    struct prefix* p = (struct prefix*)block;
+    prefix_set_size(block, size);
+    p->word1 = (unsigned long long)(thread & 0xFFFF) << 48
+        | (unsigned long long)(tag_curr & 0xFFFF) << 32
+        | (unsigned long long)(flags & 0xFF) << 24
+        | (site & 0xFFFFFF);
+}
+
+static size_t prefix_size(const void* block)
+{
+    return ((const struct prefix*)block)->word0 & PREFIX_SIZE_MAX;
+}
+
+static int prefix_valid(const void* block)
+{
+    return (((const struct prefix*)block)->word0 >> 48)
+        == prefix_check(block, prefix_size(block));
+}
+
+static unsigned int prefix_thread(const void* block)
+{
+    return (((const struct prefix*)block)->word1 >> 48) & 0xFFFF;
+}
+
+static unsigned int prefix_tag(const void* block)
+{
+    return (((const struct prefix*)block)->word1 >> 32) & 0xFFFF;
+}
+
+static __attribute__((unused)) unsigned int prefix_flags(const void* block)
+{
+    return (((const struct prefix*)block)->word1 >> 24) & 0xFF;
+}
+
+static __attribute__((unused)) unsigned int prefix_site(const void* block)
+{
+    return ((const struct prefix*)block)->word1 & 0xFFFFFF;
+}
+
+/* a simple memory heap for allocations prior to dlsym loading */
+#define INIT_HEAP_SIZE 1024*1024
+static char init_heap[INIT_HEAP_SIZE];
+static size_t init_heap_use = 0;
+static const int log_operations_init_heap = 0;
+
+/* output */
+#define PPREFIX "malloc_count ### "
+
+#if MALLOC_COUNT_OMPT
+#include <omp-tools.h>
+#endif
+
+#if MALLOC_COUNT_EVENTS
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "malloc_count_event.h"
+#endif
+
+#if MALLOC_COUNT_LIVE
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#if MALLOC_COUNT_SITES
+#include <execinfo.h>
+#endif
+
+#if MALLOC_COUNT_PERCPU
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#if MALLOC_COUNT_GROW
+#include <malloc.h>
+#endif
+
+/* monotonic clock in nanoseconds, used for timing allocator calls */
+static __attribute__((unused)) long long timestamp_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* simple spin lock for the rarely modified internal tables */
+static __attribute__((unused)) void spin_lock(volatile int* lock)
+{
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (*lock) { }
+    }
+}
+
+static __attribute__((unused)) void spin_unlock(volatile int* lock)
+{
+    __sync_lock_release(lock);
+}
+
+/* small sequential number of the calling thread, starting at 1 */
+static __thread unsigned int thread_id = 0;
+static unsigned int thread_id_next = 0;
+
+static __attribute__((unused)) unsigned int get_thread_id(void)
+{
+    if (!thread_id) thread_id = __sync_add_and_fetch(&thread_id_next, 1);
+    return thread_id;
+}
+
+/****************************************************/
+/* self-profiling of the time spent in malloc_count */
+/****************************************************/
+
+#if MALLOC_COUNT_SELF_PROFILE
+
+/* parts of malloc_count whose run time is measured */
+enum {
+    SELF_COUNT, SELF_CALLBACK, SELF_LOG, SELF_OMPT, SELF_STREAM, SELF_TRACE,
+    SELF_LIVE, SELF_SITES, SELF_UNTOUCHED, SELF_CHURN, SELF_PAIRS,
+    SELF_PARTS
+};
+
+static const char* self_part_name[SELF_PARTS] = {
+    "counting", "callback", "logging", "ompt", "stream", "trace", "live",
+    "sites", "untouched", "churn", "pairs"
+};
+
+static long long self_time_ns[SELF_PARTS];
+static long long self_clock_reads = 0;  /* number of timestamp_ns() calls */
+static long long self_clock_ns = 0;     /* calibrated cost of one call */
+
+/* number of blocks currently allocated with a prefix, and its peak */
+static long long self_blocks = 0, self_blocks_peak = 0;
+
+/* bytes of dynamically allocated internal buffers */
+static long long self_stream_bytes = 0, self_trace_bytes = 0;
+
+static void self_account(int part, long long ts)
+{
+    __sync_add_and_fetch(&self_time_ns[part], timestamp_ns() - ts);
+    __sync_add_and_fetch(&self_clock_reads, 2);
+}
+
+static void self_count_block(long long inc)
+{
+    long long myblocks = __sync_add_and_fetch(&self_blocks, inc), mypeak;
+    while ((mypeak = self_blocks_peak) < myblocks &&
+           !__sync_bool_compare_and_swap(&self_blocks_peak, mypeak, myblocks))
+    { }
+}
+
+#define SELF_DECL(ts)           long long ts;
+#define SELF_BEGIN(ts)          ts = timestamp_ns()
+#define SELF_END(part, ts)      self_account(part, ts)
+#define SELF_BLOCK(inc)         self_count_block(inc)
+
+#else
+
+#define SELF_DECL(ts)
+#define SELF_BEGIN(ts)
+#define SELF_END(part, ts)
+#define SELF_BLOCK(inc)
+
+#endif /* MALLOC_COUNT_SELF_PROFILE */
+
+/*****************************************/
+/* run-time memory allocation statistics */
+/*****************************************/
+
+static long long peak = 0, curr = 0, total = 0, num_allocs = 0;
+
+static malloc_count_callback_type callback = NULL;
+static void* callback_cookie = NULL;
+
+#if MALLOC_COUNT_PERCPU
+
+/* counters in each per-CPU slot */
+enum { PERCPU_CURR, PERCPU_TOTAL, PERCPU_ALLOCS, PERCPU_FIELDS };
+
+/* one cache line of counters per CPU */
+struct percpu_slot {
+    long long v[PERCPU_FIELDS];
+} __attribute__((aligned(64)));
+
+#define PERCPU_MAX_CPUS 1024
+
+/* slots of CPUs 0 .. percpu_cpus-1, and one last shared slot which is only
+ * updated with atomics, for higher CPU numbers and threads without rseq */
+static struct percpu_slot percpu_slots[PERCPU_MAX_CPUS + 1];
+static int percpu_cpus = PERCPU_MAX_CPUS;
+
+/* bytes allocated and freed by a thread since it last folded the slots */
+static __thread long long percpu_unfolded = 0;
+
+/* serializes folds, so that an older sum cannot overwrite a newer one */
+static volatile int percpu_fold_lock = 0;
+
+#if defined(__x86_64__)
+#define PERCPU_RSEQ 1
+
+/* the per-thread rseq area registered by glibc, see linux/rseq.h */
+struct rseq_area {
+    unsigned int cpu_id_start;
+    volatile int cpu_id;
+    unsigned long long rseq_cs;
+    unsigned int flags;
+};
+
+/* exported by glibc >= 2.35, weak to run with older ones */
+extern const long __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+
+/* whether glibc registered rseq areas for all threads */
+static int percpu_rseq = 0;
+
+static struct rseq_area* rseq_self(void)
+{
+    char* tp;
+    __asm__ ("movq %%fs:0, %0" : "=r" (tp));
+    return (struct rseq_area*)(tp + __rseq_offset);
+}
+
+/* add count to *v if the thread is still on cpu, as restartable sequence:
+ * the kernel diverts to the abort label if the thread is preempted,
+ * migrated or signaled before the single committing add. The abort handler
+ * is preceded by glibc's signature 0x53053053. Returns -1 on abort. */
+static int rseq_add(struct rseq_area* rs, int cpu, long long* v,
+                    long long count)
+{
+    __asm__ __volatile__ goto (
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0x0, 0x0\n\t"
+        ".quad 1f, (2f - 1f), 4f\n\t"
+        ".popsection\n\t"
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %[rseq_cs]\n\t"
+        "1:\n\t"
+        "cmpl %[cpu], %[cpu_id]\n\t"
+        "jnz 4f\n\t"
+        "addq %[count], %[v]\n\t"
+        "2:\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "jmp %l[abort]\n\t"
+        ".popsection\n\t"
+        :
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id),
+          [rseq_cs] "m" (rs->rseq_cs), [v] "m" (*v), [count] "er" (count)
+        : "memory", "cc", "rax"
+        : abort);
+    return 0;
+abort:
+    return -1;
+}
+
+#endif /* __x86_64__ */
+
+/* add count to a counter in the slot of the current CPU */
+static void percpu_add(int field, long long count)
+{
+    int cpu;
+#if PERCPU_RSEQ
+    if (percpu_rseq) {
+        struct rseq_area* rs = rseq_self();
+        while ((cpu = rs->cpu_id) >= 0 && cpu < percpu_cpus) {
+            if (rseq_add(rs, cpu, &percpu_slots[cpu].v[field], count) == 0)
+                return;
+        }
+        cpu = percpu_cpus; /* the shared slot */
+    }
+    else
+#endif
+    {
+        cpu = sched_getcpu();
+        if (cpu < 0 || cpu >= percpu_cpus) cpu = percpu_cpus;
+    }
+    __sync_add_and_fetch(&percpu_slots[cpu].v[field], count);
+}
+
+/* sum the slots into curr, total and num_allocs, and raise the peak */
+static long long percpu_fold(void)
+{
+    long long sum[PERCPU_FIELDS] = { 0, 0, 0 }, mypeak;
+    int i, f;
+
+    spin_lock(&percpu_fold_lock);
+
+    for (i = 0; i <= percpu_cpus; ++i) {
+        for (f = 0; f < PERCPU_FIELDS; ++f)
+            sum[f] += percpu_slots[i].v[f];
+    }
+    __sync_lock_test_and_set(&curr, sum[PERCPU_CURR]);
+    __sync_lock_test_and_set(&total, sum[PERCPU_TOTAL]);
+    __sync_lock_test_and_set(&num_allocs, sum[PERCPU_ALLOCS]);
+
+    while ((mypeak = peak) < sum[PERCPU_CURR] &&
+           !__sync_bool_compare_and_swap(&peak, mypeak, sum[PERCPU_CURR])) { }
+
+    spin_unlock(&percpu_fold_lock);
+    return sum[PERCPU_CURR];
+}
+
+/* fold the slots once the calling thread changed batch bytes, returns the
+ * current allocation summed over the slots either way */
+static long long percpu_fold_batch(long long bytes)
+{
+    long long sum = 0;
+    int i;
+
+    if ((percpu_unfolded += bytes) >= MALLOC_COUNT_PERCPU_BATCH) {
+        percpu_unfolded = 0;
+        return percpu_fold();
+    }
+    for (i = 0; i <= percpu_cpus; ++i)
+        sum += percpu_slots[i].v[PERCPU_CURR];
+    return sum;
+}
+
+/* set up the slots, called by init() before the first counted allocation */
+static void percpu_init(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    if (n > 0 && n < PERCPU_MAX_CPUS) percpu_cpus = n;
+#if PERCPU_RSEQ
+    percpu_rseq = (&__rseq_size != NULL && __rseq_size > 0);
+#endif
+}
+
+#define COUNT_FOLD()    percpu_fold()
+
+#else
+
+#define COUNT_FOLD()
+
+#endif /* MALLOC_COUNT_PERCPU */
+
+/* invoke user callback with the current allocation */
+static void run_callback(long long mycurr)
+{
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+    callback(callback_cookie, mycurr);
+    SELF_END(SELF_CALLBACK, ts);
+}
+
+/* add num allocations of together inc bytes to statistics */
+static void inc_count(size_t inc, size_t num)
+{
+#if MALLOC_COUNT_PERCPU
+    long long mycurr;
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+    percpu_add(PERCPU_CURR, inc);
+    percpu_add(PERCPU_TOTAL, inc);
+    percpu_add(PERCPU_ALLOCS, num);
+    mycurr = percpu_fold_batch(inc);
+    SELF_END(SELF_COUNT, ts);
+    if (callback) run_callback(mycurr);
+#elif THREAD_SAFE_GCC_INTRINSICS
+    long long mycurr;
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+    mycurr = __sync_add_and_fetch(&curr, inc);
+    if (mycurr > peak) peak = mycurr;
+    total += inc;
+    SELF_END(SELF_COUNT, ts);
+    if (callback) run_callback(mycurr);
+    num_allocs += num;
+#else
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+    if ((curr += inc) > peak) peak = curr;
+    total += inc;
+    SELF_END(SELF_COUNT, ts);
+    if (callback) run_callback(curr);
+    num_allocs += num;
+#endif
+}
+
+/* decrement allocation to statistics */
+static void dec_count(size_t dec)
+{
+#if MALLOC_COUNT_PERCPU
+    long long mycurr = 0;
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+    percpu_add(PERCPU_CURR, -(long long)dec);
+    if (callback) mycurr = percpu_fold_batch(dec);
+    SELF_END(SELF_COUNT, ts);
+    if (callback) run_callback(mycurr);
+#elif THREAD_SAFE_GCC_INTRINSICS
+    long long mycurr;
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+    mycurr = __sync_sub_and_fetch(&curr, dec);
+    SELF_END(SELF_COUNT, ts);
+    if (callback) run_callback(mycurr);
+#else
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+    curr -= dec;
+    SELF_END(SELF_COUNT, ts);
+    if (callback) run_callback(curr);
+#endif
+}
+
+/* add a logical allocation of a custom pool to the statistics, its bytes are
+ * carved out of a block which is counted already, hence only total and
+ * num_allocs are raised */
+static void inc_total(size_t inc)
+{
+#if MALLOC_COUNT_PERCPU
+    percpu_add(PERCPU_TOTAL, inc);
+    percpu_add(PERCPU_ALLOCS, 1);
+#else
+    total += inc;
+    ++num_allocs;
+#endif
+}
+
+/* user function to return the currently allocated amount of memory */
+extern size_t malloc_count_current(void)
+{
+    COUNT_FOLD();
+    return curr;
+}
+
+/* user function to return the peak allocation */
+extern size_t malloc_count_peak(void)
+{
+    COUNT_FOLD();
+    return peak;
+}
+
+/* user function to reset the peak allocation to current */
+extern void malloc_count_reset_peak(void)
+{
+    long long mypeak;
+    COUNT_FOLD();
+    /* swap rather than store: a concurrent fold may raise peak meanwhile */
+    do {
+        mypeak = peak;
+    } while (!__sync_bool_compare_and_swap(&peak, mypeak, curr));
+}
+
+/* user function to return total number of allocations */
+extern size_t malloc_count_num_allocs(void)
+{
+    COUNT_FOLD();
+    return num_allocs;
+}
+
+/* user function which prints current and peak allocation to stderr */
+extern void malloc_count_print_status(void)
+{
+    COUNT_FOLD();
+    fprintf(stderr, PPREFIX "current %'lld, peak %'lld\n",
+            curr, peak);
+}
+
+/* user function to supply a memory profile callback */
+void malloc_count_set_callback(malloc_count_callback_type cb, void* cookie)
+{
+    callback = cb;
+    callback_cookie = cookie;
+}
+
+/* user function to set the tag of the calling thread's allocations */
+extern unsigned int malloc_count_set_tag(unsigned int tag)
+{
+    unsigned int prev = tag_curr;
+    tag_curr = tag & 0xFFFF;
+    return prev;
+}
+
+/* user function to return the tag of an allocated block */
+extern unsigned int malloc_count_get_tag(const void* ptr)
+{
+    if (!ptr) return 0;
+    return prefix_tag((const char*)ptr - alignment);
+}
+
+/* user function to return the thread which allocated a block */
+extern unsigned int malloc_count_get_thread(const void* ptr)
+{
+    if (!ptr) return 0;
+    return prefix_thread((const char*)ptr - alignment);
+}
+
+/*********************************************************/
+/* attribution of allocations to OpenMP parallel regions */
+/*********************************************************/
+
+#if MALLOC_COUNT_OMPT
+
+/* statistics of one parallel region, identified by its code pointer */
+struct ompt_region
+{
+    const void* codeptr;        /* return address of the region's fork */
+    long long   runs;           /* number of times the region was started */
+    long long   max_threads;    /* maximum number of implicit tasks */
+    long long   curr;           /* bytes held by the current run */
+    long long   peak;           /* maximum of curr over all runs */
+    long long   total, num_allocs;
+    long long   time_ns;        /* nanoseconds spent in the allocator */
+};
+
+/* maximum number of distinct parallel regions recorded */
+#define OMPT_REGIONS_MAX 256
+
+static struct ompt_region ompt_regions[OMPT_REGIONS_MAX];
+static int ompt_regions_num = 0;
+static volatile int ompt_regions_lock = 0;
+
+/* region in which the calling thread currently executes an implicit task */
+static __thread struct ompt_region* ompt_region_curr = NULL;
+
+/* find or create the record for the region at codeptr */
+static struct ompt_region* ompt_region_find(const void* codeptr)
+{
+    struct ompt_region* r = NULL;
+    int i;
+
+    spin_lock(&ompt_regions_lock);
+    for (i = 0; i < ompt_regions_num; ++i) {
+        if (ompt_regions[i].codeptr == codeptr) {
+            r = &ompt_regions[i];
+            break;
+        }
+    }
+    if (!r && ompt_regions_num < OMPT_REGIONS_MAX) {
+        r = &ompt_regions[ompt_regions_num++];
+        r->codeptr = codeptr;
+    }
+    spin_unlock(&ompt_regions_lock);
+
+    return r;
+}
+
+/* account an allocation (inc > 0) or free (inc < 0) made inside a region */
+static void ompt_region_count(struct ompt_region* r, long long inc,
+                              long long time_ns)
+{
+    long long mycurr, mypeak;
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+
+    mycurr = __sync_add_and_fetch(&r->curr, inc);
+    if (inc > 0) {
+        __sync_add_and_fetch(&r->total, inc);
+        __sync_add_and_fetch(&r->num_allocs, 1);
+        while ((mypeak = r->peak) < mycurr &&
+               !__sync_bool_compare_and_swap(&r->peak, mypeak, mycurr)) { }
+    }
+    __sync_add_and_fetch(&r->time_ns, time_ns);
+    SELF_END(SELF_OMPT, ts);
+}
+
+static void ompt_cb_parallel_begin(
+    ompt_data_t* encountering_task_data,
+    const ompt_frame_t* encountering_task_frame,
+    ompt_data_t* parallel_data, unsigned int requested_parallelism,
+    int flags, const void* codeptr_ra)
+{
+    struct ompt_region* r = ompt_region_find(codeptr_ra);
+    (void)encountering_task_data; (void)encountering_task_frame;
+    (void)requested_parallelism; (void)flags;
+
+    /* each run starts from zero, so the peak is that of the largest run */
+    if (r) {
+        __sync_add_and_fetch(&r->runs, 1);
+        __sync_lock_test_and_set(&r->curr, 0);
+    }
+    parallel_data->ptr = r;
+}
+
+static void ompt_cb_implicit_task(
+    ompt_scope_endpoint_t endpoint, ompt_data_t* parallel_data,
+    ompt_data_t* task_data, unsigned int actual_parallelism,
+    unsigned int index, int flags)
+{
+    struct ompt_region* r;
+    long long mymax;
+    (void)index;
+
+    if (flags & ompt_task_initial) return;
+
+    if (endpoint == ompt_scope_begin) {
+        r = (struct ompt_region*)parallel_data->ptr;
+        /* remember enclosing region for nested parallelism */
+        task_data->ptr = ompt_region_curr;
+        ompt_region_curr = r;
+        if (r) {
+            while ((mymax = r->max_threads) < (long long)actual_parallelism &&
+                   !__sync_bool_compare_and_swap(
+                       &r->max_threads, mymax, actual_parallelism)) { }
+        }
+    }
+    else if (endpoint == ompt_scope_end) {
+        ompt_region_curr = (struct ompt_region*)task_data->ptr;
+    }
+}
+
+static int ompt_initialize(ompt_function_lookup_t lookup,
+                           int initial_device_num, ompt_data_t* tool_data)
+{
+    ompt_set_callback_t set_callback =
+        (ompt_set_callback_t)lookup("ompt_set_callback");
+    (void)initial_device_num; (void)tool_data;
+
+    if (!set_callback) return 0;
+
+    set_callback(ompt_callback_parallel_begin,
+                 (ompt_callback_t)ompt_cb_parallel_begin);
+    set_callback(ompt_callback_implicit_task,
+                 (ompt_callback_t)ompt_cb_implicit_task);
+
+    return 1; /* keep tool active */
+}
+
+static void ompt_finalize(ompt_data_t* tool_data)
+{
+    (void)tool_data;
+}
+
+/* entry point searched for by the OpenMP runtime */
+extern ompt_start_tool_result_t* ompt_start_tool(
+    unsigned int omp_version, const char* runtime_version)
+{
+    static ompt_start_tool_result_t result;
+    (void)omp_version; (void)runtime_version;
+
+    result.initialize = ompt_initialize;
+    result.finalize = ompt_finalize;
+    result.tool_data.value = 0;
+    return &result;
+}
+
+/* print statistics of all recorded parallel regions to stderr */
+static void ompt_print_regions(void)
+{
+    Dl_info info;
+    int i;
+
+    for (i = 0; i < ompt_regions_num; ++i)
+    {
+        const struct ompt_region* r = &ompt_regions[i];
+
+        if (dladdr(r->codeptr, &info) && info.dli_sname) {
+            fprintf(stderr, PPREFIX "omp region %p (%s+0x%lx):",
+                    r->codeptr, info.dli_sname,
+                    (unsigned long)((char*)r->codeptr - (char*)info.dli_saddr));
+        }
+        else {
+            fprintf(stderr, PPREFIX "omp region %p:", r->codeptr);
+        }
+        fprintf(stderr, " runs %'lld, threads %'lld, allocs %'lld,"
+                " total %'lld, peak %'lld, allocator time %.6f s\n",
+                r->runs, r->max_threads, r->num_allocs,
+                r->total, r->peak, r->time_ns / 1e9);
+    }
+}
+
+#endif /* MALLOC_COUNT_OMPT */
+
+/*****************************************************/
+/* streaming of events to an analyzer process via shm */
+/*****************************************************/
+
+#if MALLOC_COUNT_STREAM
+
+/* number of rings, i.e. of threads which can publish events concurrently */
+static const size_t stream_num_rings = 64;
+
+/* events per ring, must be a power of two */
+static const size_t stream_capacity = 16384;
+
+static struct malloc_count_stream_header* stream_header = NULL;
+static size_t stream_bytes = 0;
+static char stream_name[64];
+
+/* ring owned by the calling thread, released at thread exit */
+static __thread struct malloc_count_stream_ring* stream_ring = NULL;
+static pthread_key_t stream_key;
+
+static void stream_release_ring(void* ring)
+{
+    stream_ring = NULL;
+    __atomic_store_n(&((struct malloc_count_stream_ring*)ring)->owner, 0,
+                     __ATOMIC_RELEASE);
+}
+
+/* claim an unowned ring for the calling thread */
+static struct malloc_count_stream_ring* stream_acquire_ring(void)
+{
+    unsigned int tid = thread_id;
+    size_t i;
+
+    for (i = 0; i < stream_num_rings; ++i)
+    {
+        struct malloc_count_stream_ring* r =
+            MALLOC_COUNT_STREAM_RING(stream_header, i);
+
+        if (r->owner == 0 && __sync_bool_compare_and_swap(&r->owner, 0, tid))
+        {
+            stream_ring = r;
+            pthread_setspecific(stream_key, r);
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/* publish an event into the calling thread's ring, drop it if it is full */
+static void stream_event(const struct malloc_count_event* ev)
+{
+    struct malloc_count_stream_ring* r = stream_ring;
+    uint64_t head;
+    SELF_DECL(ts)
+
+    if (!stream_header) return;
+    SELF_BEGIN(ts);
+
+    if (!r) r = stream_acquire_ring();
+
+    if (!r) {
+        __sync_add_and_fetch(&stream_header->dropped_norings, 1);
+    }
+    else if ((head = r->head) -
+             __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= stream_capacity) {
+        r->dropped++;
+    }
+    else {
+        MALLOC_COUNT_STREAM_EVENTS(r)[head & (stream_capacity - 1)] = *ev;
+        __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    SELF_END(SELF_STREAM, ts);
+}
+
+static void stream_open(void);
+
+/* a forked child must not publish into its parent's rings, it gets its own
+ * shared memory object named after its pid */
+static void stream_atfork_child(void)
+{
+    if (!stream_header) return;
+
+    munmap(stream_header, stream_bytes);
+    stream_header = NULL;
+    stream_ring = NULL;
+    pthread_setspecific(stream_key, NULL);
+
+    stream_open();
+}
+
+/* create and map the shared memory object named after the pid */
+static void stream_open(void)
+{
+    static int once = 0;
+    struct malloc_count_stream_header* h;
+    size_t ring_bytes = sizeof(struct malloc_count_stream_ring)
+        + stream_capacity * sizeof(struct malloc_count_event);
+    int fd;
+
+    stream_bytes = sizeof(struct malloc_count_stream_header)
+        + stream_num_rings * ring_bytes;
+    snprintf(stream_name, sizeof(stream_name), MALLOC_COUNT_STREAM_NAME "%d",
+             (int)getpid());
+
+    fd = shm_open(stream_name, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (fd < 0) {
+        fprintf(stderr, PPREFIX "could not create shm %s !!!\n", stream_name);
+        return;
+    }
+    if (ftruncate(fd, stream_bytes) != 0) {
+        fprintf(stderr, PPREFIX "could not resize shm %s !!!\n", stream_name);
+        close(fd);
+        shm_unlink(stream_name);
+        return;
+    }
+
+    h = (struct malloc_count_stream_header*)
+        mmap(NULL, stream_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+        fprintf(stderr, PPREFIX "could not map shm %s !!!\n", stream_name);
+        shm_unlink(stream_name);
+        return;
+    }
+
+    h->pid = getpid();
+    h->num_rings = stream_num_rings;
+    h->capacity = stream_capacity;
+    h->ring_bytes = ring_bytes;
+    __atomic_store_n(&h->magic, MALLOC_COUNT_STREAM_MAGIC, __ATOMIC_RELEASE);
+
+    if (!once) {
+        pthread_key_create(&stream_key, stream_release_ring);
+        pthread_atfork(NULL, NULL, stream_atfork_child);
+        once = 1;
+    }
+
+#if MALLOC_COUNT_SELF_PROFILE
+    self_stream_bytes = stream_bytes;
+#endif
+
+    fprintf(stderr, PPREFIX "streaming events to shm %s\n", stream_name);
+    stream_header = h;
+}
+
+/* mark the stream as finished and remove its name, attached analyzers keep
+ * their mapping until they have consumed all events */
+static void stream_close(void)
+{
+    struct malloc_count_stream_header* h = stream_header;
+    size_t i;
+    unsigned long long dropped;
+
+    if (!h) return;
+    stream_header = NULL;
+
+    dropped = h->dropped_norings;
+    for (i = 0; i < h->num_rings; ++i)
+        dropped += MALLOC_COUNT_STREAM_RING(h, i)->dropped;
+
+    __atomic_store_n(&h->finished, 1, __ATOMIC_RELEASE);
+    shm_unlink(stream_name);
+
+    fprintf(stderr, PPREFIX "stream: %'llu events dropped\n", dropped);
+}
+
+#endif /* MALLOC_COUNT_STREAM */
+
+/*********************************************/
+/* writing of all events into the trace file */
+/*********************************************/
+
+#if MALLOC_COUNT_TRACE
+
+/* number of per-thread buffers; threads without one write events directly */
+static const size_t trace_num_buffers = 64;
+
+/* events per buffer, written to the file when full */
+#define TRACE_BUFFER_EVENTS 4096
+
+struct trace_buffer
+{
+    volatile unsigned int owner;        /* thread id, 0 if unowned */
+    size_t num;                         /* number of events in buffer */
+    struct malloc_count_event events[TRACE_BUFFER_EVENTS];
+};
+
+static struct trace_buffer* trace_buffers = NULL;
+static int trace_fd = -1;
+static volatile int trace_lock = 0;
+
+/* buffer owned by the calling thread, flushed and released at thread exit */
+static __thread struct trace_buffer* trace_buffer = NULL;
+static pthread_key_t trace_key;
+
+/* append events to the trace file, whole buffers at once */
+static void trace_write(const struct malloc_count_event* ev, size_t num)
+{
+    const char* p = (const char*)ev;
+    size_t left = num * sizeof(*ev);
+    ssize_t wb;
+
+    spin_lock(&trace_lock);
+    while (left > 0 && (wb = write(trace_fd, p, left)) > 0) {
+        p += wb, left -= wb;
+    }
+    spin_unlock(&trace_lock);
+}
+
+static void trace_release_buffer(void* buffer)
+{
+    struct trace_buffer* b = (struct trace_buffer*)buffer;
+
+    trace_buffer = NULL;
+    if (trace_fd >= 0) trace_write(b->events, b->num);
+    b->num = 0;
+    __atomic_store_n(&b->owner, 0, __ATOMIC_RELEASE);
+}
+
+/* claim an unowned buffer for the calling thread */
+static struct trace_buffer* trace_acquire_buffer(void)
+{
+    size_t i;
+
+    for (i = 0; i < trace_num_buffers; ++i)
+    {
+        struct trace_buffer* b = &trace_buffers[i];
+
+        if (b->owner == 0 &&
+            __sync_bool_compare_and_swap(&b->owner, 0, thread_id))
+        {
+            trace_buffer = b;
+            pthread_setspecific(trace_key, b);
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/* append an event to the calling thread's buffer */
+static void trace_event(const struct malloc_count_event* ev)
+{
+    struct trace_buffer* b = trace_buffer;
+    SELF_DECL(ts)
+
+    if (trace_fd < 0) return;
+    SELF_BEGIN(ts);
+
+    if (!b) b = trace_acquire_buffer();
+
+    if (!b) {
+        trace_write(ev, 1);
+    }
+    else {
+        b->events[b->num++] = *ev;
+        if (b->num == TRACE_BUFFER_EVENTS) {
+            trace_write(b->events, b->num);
+            b->num = 0;
+        }
+    }
+
+    SELF_END(SELF_TRACE, ts);
+}
+
+static void trace_open(void);
+
+/* a forked child writes its own trace file named after its pid */
+static void trace_atfork_child(void)
+{
+    if (trace_fd < 0) return;
+
+    close(trace_fd);
+    trace_fd = -1;
+    munmap(trace_buffers, trace_num_buffers * sizeof(struct trace_buffer));
+    trace_buffers = NULL;
+    trace_buffer = NULL;
+    pthread_setspecific(trace_key, NULL);
+
+    trace_open();
+}
+
+/* create the trace file and the per-thread buffers */
+static void trace_open(void)
+{
+    static int once = 0;
+    struct malloc_count_trace_header header;
+    size_t bytes = trace_num_buffers * sizeof(struct trace_buffer);
+    char filename[64];
+
+    snprintf(filename, sizeof(filename), "malloc_count-%d.trace",
+             (int)getpid());
+
+    trace_buffers = (struct trace_buffer*)
+        mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (trace_buffers == MAP_FAILED) {
+        fprintf(stderr, PPREFIX "could not map trace buffers !!!\n");
+        trace_buffers = NULL;
+        return;
+    }
+
+    trace_fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0644);
+    if (trace_fd < 0) {
+        fprintf(stderr, PPREFIX "could not create %s !!!\n", filename);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = MALLOC_COUNT_TRACE_MAGIC;
+    header.pid = getpid();
+    header.event_bytes = sizeof(struct malloc_count_event);
+    if (write(trace_fd, &header, sizeof(header)) != sizeof(header)) {
+        fprintf(stderr, PPREFIX "could not write %s !!!\n", filename);
+        close(trace_fd);
+        trace_fd = -1;
+        return;
+    }
+
+    if (!once) {
+        pthread_key_create(&trace_key, trace_release_buffer);
+        pthread_atfork(NULL, NULL, trace_atfork_child);
+        once = 1;
+    }
+
+#if MALLOC_COUNT_SELF_PROFILE
+    self_trace_bytes = bytes;
+#endif
+
+    fprintf(stderr, PPREFIX "writing trace to %s\n", filename);
+}
+
+/* flush the buffers of all threads and close the trace file */
+static void trace_close(void)
+{
+    int fd = trace_fd;
+    size_t i;
+
+    if (fd < 0) return;
+
+    for (i = 0; i < trace_num_buffers; ++i) {
+        if (trace_buffers[i].num)
+            trace_write(trace_buffers[i].events, trace_buffers[i].num);
+        trace_buffers[i].num = 0;
+    }
+
+    trace_fd = -1;
+    close(fd);
+}
+
+#endif /* MALLOC_COUNT_TRACE */
+
+#if MALLOC_COUNT_EVENTS
+
+/* pass an allocation event to all enabled consumers */
+static void emit_event(unsigned int type, const void* ptr, size_t size)
+{
+    struct malloc_count_event ev;
+
+    ev.ts = timestamp_ns();
+    ev.ptr = (uintptr_t)ptr;
+    ev.size = size;
+    ev.tid = get_thread_id();
+    ev.type = type;
+
+#if MALLOC_COUNT_STREAM
+    stream_event(&ev);
+#endif
+#if MALLOC_COUNT_TRACE
+    trace_event(&ev);
+#endif
+}
+
+#endif /* MALLOC_COUNT_EVENTS */
+
+/*************************************************************/
+/* call sites of allocations, identified by short backtraces */
+/*************************************************************/
+
+#if MALLOC_COUNT_SITES
+
+/* number of return addresses identifying a site */
+#define SITE_DEPTH 4
+
+/* maximum number of distinct sites, further ones are counted as unknown */
+#define SITES_MAX 4096
+
+struct site
+{
+    void*           stack[SITE_DEPTH];
+    volatile int    used;
+};
+
+/* open addressing table of sites, slot 0 is the unknown site */
+static struct site sites[SITES_MAX];
+static volatile int sites_lock = 0;
+
+/* set while the calling thread takes a backtrace, which may allocate */
+static __thread int site_busy = 0;
+
+static unsigned int site_hash(void* const* stack)
+{
+    unsigned long long h = 0;
+    int i;
+
+    for (i = 0; i < SITE_DEPTH; ++i)
+        h = (h ^ (uintptr_t)stack[i]) * 0x9E3779B97F4A7C15ULL;
+    return (unsigned int)(h >> 40);
+}
+
+/* find or insert the site of stack, returns 0 if the table is full */
+static unsigned int site_find(void* const* stack)
+{
+    unsigned int i = site_hash(stack) % (SITES_MAX - 1) + 1, n;
+
+    for (n = 1; n < SITES_MAX; ++n)
+    {
+        struct site* st = &sites[i];
+
+        if (!__atomic_load_n(&st->used, __ATOMIC_ACQUIRE))
+        {
+            spin_lock(&sites_lock);
+            if (!st->used) {
+                memcpy(st->stack, stack, sizeof(st->stack));
+                __atomic_store_n(&st->used, 1, __ATOMIC_RELEASE);
+                spin_unlock(&sites_lock);
+                return i;
+            }
+            spin_unlock(&sites_lock);
+        }
+        if (memcmp(st->stack, stack, sizeof(st->stack)) == 0)
+            return i;
+
+        i = i % (SITES_MAX - 1) + 1;
+    }
+    return 0;
+}
+
+/* site of an allocation made by the function returning to caller */
+static unsigned int site_capture(void* caller)
+{
+    void* frames[SITE_DEPTH + 8];
+    void* stack[SITE_DEPTH];
+    int n, i, k;
+    unsigned int site;
+    SELF_DECL(ts)
+
+    if (site_busy) return 0;
+    SELF_BEGIN(ts);
+
+    site_busy = 1;
+    n = backtrace(frames, SITE_DEPTH + 8);
+    site_busy = 0;
+
+    /* skip the frames inside malloc_count */
+    for (i = 0; i < n && frames[i] != caller; ++i) { }
+    if (i == n) {
+        frames[0] = caller;
+        i = 0, n = 1;
+    }
+
+    memset(stack, 0, sizeof(stack));
+    for (k = 0; k < SITE_DEPTH && i + k < n; ++k)
+        stack[k] = frames[i + k];
+
+    site = site_find(stack);
+    SELF_END(SELF_SITES, ts);
+    return site;
+}
+
+/* write the symbolized stack of a site into buf. Functions of executables
+ * linked without -rdynamic are given as file+offset for addr2line. */
+static const char* site_name(unsigned int site, char* buf, size_t len)
+{
+    Dl_info info;
+    size_t pos = 0;
+    const char* file;
+    char* a;
+    int k;
+
+    if (site == 0) return "unknown";
+
+    buf[0] = 0;
+    for (k = 0; k < SITE_DEPTH && sites[site].stack[k] && pos < len; ++k)
+    {
+        a = (char*)sites[site].stack[k];
+
+        if (dladdr(a, &info) && info.dli_sname) {
+            pos += snprintf(buf + pos, len - pos, "%s%s+0x%lx", k ? " < " : "",
+                            info.dli_sname,
+                            (unsigned long)(a - (char*)info.dli_saddr));
+        }
+        else if (info.dli_fname) {
+            file = strrchr(info.dli_fname, '/');
+            pos += snprintf(buf + pos, len - pos, "%s%s+0x%lx", k ? " < " : "",
+                            file ? file + 1 : info.dli_fname,
+                            (unsigned long)(a - (char*)info.dli_fbase));
+        }
+        else {
+            pos += snprintf(buf + pos, len - pos, "%s%p", k ? " < " : "", a);
+        }
+    }
+    return buf;
+}
+
+#define SITE_CAPTURE(caller)    site_capture(caller)
+
+#else
+
+#define SITE_CAPTURE(caller)    0
+
+#endif /* MALLOC_COUNT_SITES */
+
+/***************************************************/
+/* table of live blocks and the heap occupancy map */
+/***************************************************/
+
+#if MALLOC_COUNT_LIVE
+
+/* live block, ptr is NULL for empty and live_deleted for deleted slots */
+struct live_block
+{
+    void*           ptr;
+    size_t          size;
+    unsigned int    tid;        /* thread which allocated the block */
+    unsigned int    site;       /* call site, 0 if unknown */
+};
+
+#define live_deleted ((void*)1)
+
+/* open addressing hash table with linear probing, mapped directly from the
+ * kernel since malloc() cannot be used. */
+static struct live_block* live_table = NULL;
+static size_t live_capacity = 0;        /* number of slots, a power of two */
+static unsigned int live_shift = 0;     /* 64 - log2(live_capacity) */
+static size_t live_used = 0;            /* live and deleted slots */
+static size_t live_num = 0;             /* live slots */
+static volatile int live_lock = 0;
+
+/* initial number of slots */
+static const size_t live_initial_capacity = 65536;
+
+static size_t live_hash(const void* ptr)
+{
+    return (size_t)((((unsigned long long)(uintptr_t)ptr >> 4)
+                     * 0x9E3779B97F4A7C15ULL) >> live_shift);
+}
+
+/* rebuild the table with capacity slots, which drops deleted slots */
+static int live_rehash(size_t capacity)
+{
+    struct live_block* table;
+    size_t i, j;
+    unsigned int shift = 64;
+
+    table = (struct live_block*)
+        mmap(NULL, capacity * sizeof(struct live_block),
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) return 0;
+
+    for (i = capacity; i > 1; i >>= 1) --shift;
+    live_shift = shift;
+
+    for (i = 0; i < live_capacity; ++i)
+    {
+        if (live_table[i].ptr == NULL || live_table[i].ptr == live_deleted)
+            continue;
+        j = live_hash(live_table[i].ptr);
+        while (table[j].ptr) j = (j + 1) & (capacity - 1);
+        table[j] = live_table[i];
+    }
+
+    if (live_table)
+        munmap(live_table, live_capacity * sizeof(struct live_block));
+
+    live_table = table;
+    live_capacity = capacity;
+    live_used = live_num;
+    return 1;
+}
+
+/* record a new live block */
+static void live_insert(void* ptr, size_t size, unsigned int site)
+{
+    size_t i;
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+
+    spin_lock(&live_lock);
+
+    /* keep the table at most 3/4 full including deleted slots */
+    if ((live_used + 1) * 4 > live_capacity * 3)
+    {
+        size_t capacity = live_capacity ? live_capacity : live_initial_capacity;
+        if ((live_num + 1) * 2 > capacity) capacity *= 2;
+
+        if (!live_rehash(capacity)) {
+            spin_unlock(&live_lock);
+            fprintf(stderr, PPREFIX "could not grow live block table !!!\n");
+            return;
+        }
+    }
+
+    i = live_hash(ptr);
+    while (live_table[i].ptr && live_table[i].ptr != live_deleted)
+        i = (i + 1) & (live_capacity - 1);
+
+    if (live_table[i].ptr == NULL) ++live_used;
+    live_table[i].ptr = ptr;
+    live_table[i].size = size;
+    live_table[i].tid = get_thread_id();
+    live_table[i].site = site;
+    ++live_num;
+
+    spin_unlock(&live_lock);
+    SELF_END(SELF_LIVE, ts);
+}
+
+/* remove a block from the table, returns 1 and its record in *block if it
+ * was found */
+static int live_remove(void* ptr, struct live_block* block)
+{
+    size_t i;
+    int found = 0;
+    SELF_DECL(ts)
+
+    if (!live_table) return 0;
+    SELF_BEGIN(ts);
+
+    spin_lock(&live_lock);
+
+    i = live_hash(ptr);
+    while (live_table[i].ptr && live_table[i].ptr != ptr)
+        i = (i + 1) & (live_capacity - 1);
+
+    if (live_table[i].ptr) {
+        *block = live_table[i];
+        live_table[i].ptr = live_deleted;
+        --live_num;
+        found = 1;
+    }
+
+    spin_unlock(&live_lock);
+    SELF_END(SELF_LIVE, ts);
+    return found;
+}
+
+/* check whether ptr is a live block of size bytes, the caller holds live_lock */
+static __attribute__((unused)) int live_contains(const void* ptr, size_t size)
+{
+    size_t i;
+
+    if (!live_table) return 0;
+
+    i = live_hash(ptr);
+    while (live_table[i].ptr && live_table[i].ptr != ptr)
+        i = (i + 1) & (live_capacity - 1);
+
+    return live_table[i].ptr == ptr && live_table[i].size == size;
+}
+
+/* copy the live blocks into an array mapped for the caller, which must unmap
+ * *bytes of it. Returns the number of blocks. */
+static size_t live_snapshot(struct live_block** blocks, size_t* bytes)
+{
+    size_t i, n = 0;
+
+    spin_lock(&live_lock);
+
+    *bytes = (live_num + 1) * sizeof(struct live_block);
+    *blocks = (struct live_block*)
+        mmap(NULL, *bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (*blocks == MAP_FAILED) {
+        spin_unlock(&live_lock);
+        *blocks = NULL;
+        return 0;
+    }
+
+    for (i = 0; i < live_capacity; ++i) {
+        if (live_table[i].ptr && live_table[i].ptr != live_deleted)
+            (*blocks)[n++] = live_table[i];
+    }
+
+    spin_unlock(&live_lock);
+    return n;
+}
+
+/* heap sort, as qsort() may call malloc() */
+static void sort_sift_down(char* b, size_t i, size_t n, size_t size,
+                           int (*cmp)(const void*, const void*))
+{
+    size_t c, k;
+    char t;
+
+    while ((c = 2 * i + 1) < n)
+    {
+        if (c + 1 < n && cmp(b + (c + 1) * size, b + c * size) > 0) ++c;
+        if (cmp(b + i * size, b + c * size) >= 0) break;
+        for (k = 0; k < size; ++k) {
+            t = b[i * size + k];
+            b[i * size + k] = b[c * size + k];
+            b[c * size + k] = t;
+        }
+        i = c;
+    }
+}
+
+static void sort_array(void* base, size_t n, size_t size,
+                       int (*cmp)(const void*, const void*))
+{
+    char* b = (char*)base;
+    size_t i, k;
+    char t;
+
+    for (i = n / 2; i > 0; --i) sort_sift_down(b, i - 1, n, size, cmp);
+    for (i = n; i > 1; --i) {
+        for (k = 0; k < size; ++k) {
+            t = b[k];
+            b[k] = b[(i - 1) * size + k];
+            b[(i - 1) * size + k] = t;
+        }
+        sort_sift_down(b, 0, i - 1, size, cmp);
+    }
+}
+
+/* order live blocks by address */
+static int live_cmp_ptr(const void* a, const void* b)
+{
+    const struct live_block* x = (const struct live_block*)a;
+    const struct live_block* y = (const struct live_block*)b;
+    return x->ptr < y->ptr ? -1 : x->ptr > y->ptr;
+}
+
+/* output buffer of the heap map, which is written with write() */
+struct heapmap_out
+{
+    int     fd;
+    size_t  len;
+    char    buf[8192];
+};
+
+static void heapmap_flush(struct heapmap_out* out)
+{
+    size_t off = 0;
+    ssize_t wb;
+
+    while (off < out->len && (wb = write(out->fd, out->buf + off,
+                                         out->len - off)) > 0)
+        off += wb;
+    out->len = 0;
+}
+
+static void heapmap_puts(struct heapmap_out* out, const char* str)
+{
+    size_t n = strlen(str);
+    if (out->len + n > sizeof(out->buf)) heapmap_flush(out);
+    memcpy(out->buf + out->len, str, n);
+    out->len += n;
+}
+
+/* maximum number of pages in one row of the heap map */
+#define HEAPMAP_MAX_ROW_PAGES 1024
+
+/* write one row of the heap map, preceded by a comment with its address */
+static void heapmap_row(struct heapmap_out* out, uintptr_t base,
+                        const size_t* cover, size_t page_size,
+                        size_t row_pages)
+{
+    char str[64];
+    size_t i;
+
+    snprintf(str, sizeof(str), "# 0x%lx\n", (unsigned long)base);
+    heapmap_puts(out, str);
+
+    for (i = 0; i < row_pages; ++i) {
+        if (cover[i] == 0)
+            snprintf(str, sizeof(str), "%s0", i ? " " : "");
+        else
+            snprintf(str, sizeof(str), "%s%.3f", i ? " " : "",
+                     (double)cover[i] / page_size);
+        heapmap_puts(out, str);
+    }
+    heapmap_puts(out, "\n");
+}
+
+#endif /* MALLOC_COUNT_LIVE */
+
+/* user function to write the heap occupancy map of the live blocks */
+extern int malloc_count_write_heapmap(const char* path, size_t page_size,
+                                      size_t row_pages)
+{
+#if MALLOC_COUNT_LIVE
+    struct live_block* blocks;
+    size_t num, bytes, i, rows = 0, pages = 0, live = 0;
+    size_t cover[HEAPMAP_MAX_ROW_PAGES];
+    uintptr_t row = 0, row_bytes, addr, end, page_end;
+    struct heapmap_out out;
+    char str[256];
+    int have_row = 0;
+
+    if (!page_size) page_size = 4096;
+    if (!row_pages) row_pages = 64;
+    if (row_pages > HEAPMAP_MAX_ROW_PAGES) row_pages = HEAPMAP_MAX_ROW_PAGES;
+    row_bytes = page_size * row_pages;
+
+    out.fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (out.fd < 0) {
+        fprintf(stderr, PPREFIX "could not create %s !!!\n", path);
+        return -1;
+    }
+    out.len = 0;
+
+    num = live_snapshot(&blocks, &bytes);
+    sort_array(blocks, num, sizeof(struct live_block), live_cmp_ptr);
+
+    for (i = 0; i < num; ++i) live += blocks[i].size;
+
+    snprintf(str, sizeof(str),
+             "# malloc_count heap map of %lu live blocks with %lu bytes\n"
+             "# rows of %lu pages of %lu bytes, each value is the fraction of"
+             " a page covered\n# by live blocks, rows without live blocks are"
+             " omitted\n",
+             (unsigned long)num, (unsigned long)live,
+             (unsigned long)row_pages, (unsigned long)page_size);
+    heapmap_puts(&out, str);
+
+    for (i = 0; i < num; ++i)
+    {
+        addr = (uintptr_t)blocks[i].ptr;
+        end = addr + blocks[i].size;
+
+        while (addr < end)
+        {
+            if (!have_row || addr - row >= row_bytes)
+            {
+                if (have_row)
+                    heapmap_row(&out, row, cover, page_size, row_pages);
+                row = addr - addr % row_bytes;
+                memset(cover, 0, row_pages * sizeof(size_t));
+                have_row = 1;
+                ++rows;
+            }
+
+            page_end = addr - addr % page_size + page_size;
+            if (page_end > end) page_end = end;
+
+            if (cover[(addr - row) / page_size] == 0) ++pages;
+            cover[(addr - row) / page_size] += page_end - addr;
+            addr = page_end;
+        }
+    }
+    if (have_row) heapmap_row(&out, row, cover, page_size, row_pages);
+
+    heapmap_flush(&out);
+    close(out.fd);
+    if (blocks) munmap(blocks, bytes);
+
+    fprintf(stderr, PPREFIX "heap map %s: %'lld blocks on %'lld pages in"
+            " %'lld rows, mean page fill %.1f%%\n", path,
+            (long long)num, (long long)pages, (long long)rows,
+            pages ? 100.0 * live / (pages * page_size) : 0.0);
+    return 0;
+#else
+    (void)path; (void)page_size; (void)row_pages;
+    fprintf(stderr, PPREFIX "heap map requires MALLOC_COUNT_LIVE !!!\n");
+    return -1;
+#endif
+}
+
+#if MALLOC_COUNT_LIVE
+
+/* number of entries printed in the rankings of the reports on live blocks */
+static const size_t report_top = 10;
+
+/* size of a cache line, i.e. the unit of false sharing */
+static const uintptr_t cache_line = 64;
+
+/* pair of sites whose blocks of different threads share cache lines */
+struct share_pair
+{
+    unsigned int a, b;
+    uintptr_t line;             /* shared line, while pairs are collected */
+    size_t lines;
+};
+
+static int share_cmp_sites(const void* x, const void* y)
+{
+    const struct share_pair* p = (const struct share_pair*)x;
+    const struct share_pair* q = (const struct share_pair*)y;
+    if (p->a != q->a) return p->a < q->a ? -1 : 1;
+    if (p->b != q->b) return p->b < q->b ? -1 : 1;
+    return p->line < q->line ? -1 : p->line > q->line;
+}
+
+static int share_cmp_lines(const void* x, const void* y)
+{
+    const struct share_pair* p = (const struct share_pair*)x;
+    const struct share_pair* q = (const struct share_pair*)y;
+    return p->lines > q->lines ? -1 : p->lines < q->lines;
+}
+
+#endif /* MALLOC_COUNT_LIVE */
+
+/* user function which prints the pairs of sites whose live blocks, allocated
+ * by different threads, share a cache line */
+extern void malloc_count_print_false_sharing(void)
+{
+#if MALLOC_COUNT_LIVE
+    struct live_block* blocks;
+    struct share_pair* pairs = NULL;
+    size_t num, bytes, i, j, np = 0, nr, lines = 0, shared = 0;
+    size_t pairs_bytes = 0;
+    uintptr_t first, last, prev_last = 0, shared_last = 0;
+    const struct live_block *p, *q;
+    int pass;
+#if MALLOC_COUNT_SITES
+    char name_a[512], name_b[512];
+#endif
+
+    num = live_snapshot(&blocks, &bytes);
+    sort_array(blocks, num, sizeof(struct live_block), live_cmp_ptr);
+
+    /* blocks are disjoint and sorted, so a block shares its last line with
+     * the following blocks starting in it. A line may hold more than two
+     * blocks, so every pair of them is checked. The first pass counts the
+     * pairs, the second records them. */
+    for (pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 1) {
+            pairs_bytes = (np + 1) * sizeof(struct share_pair);
+            pairs = (struct share_pair*)
+                mmap(NULL, pairs_bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (pairs == MAP_FAILED) {
+                if (blocks) munmap(blocks, bytes);
+                return;
+            }
+            np = 0;
+        }
+
+        for (i = 0; i < num; ++i)
+        {
+            p = &blocks[i];
+            first = (uintptr_t)p->ptr / cache_line;
+            last = ((uintptr_t)p->ptr + p->size - 1) / cache_line;
+            if (pass == 0) {
+                lines += last - first + 1 - (i && first == prev_last);
+                prev_last = last;
+            }
+
+            for (j = i + 1; j < num; ++j)
+            {
+                q = &blocks[j];
+                if ((uintptr_t)q->ptr / cache_line != last) break;
+                if (p->tid == q->tid) continue;
+
+                if (pass == 0) {
+                    if (shared == 0 || shared_last != last) ++shared;
+                    shared_last = last;
+                }
+                else {
+                    pairs[np].a = p->site < q->site ? p->site : q->site;
+                    pairs[np].b = p->site < q->site ? q->site : p->site;
+                    pairs[np].line = last;
+                    pairs[np].lines = 1;
+                }
+                ++np;
+            }
+        }
+    }
+
+    /* combine equal pairs of sites, counting each shared line once, and
+     * rank them */
+    sort_array(pairs, np, sizeof(struct share_pair), share_cmp_sites);
+    for (i = 0, nr = 0; i < np; ++i) {
+        if (nr && pairs[nr - 1].a == pairs[i].a &&
+            pairs[nr - 1].b == pairs[i].b) {
+            if (pairs[nr - 1].line != pairs[i].line) {
+                pairs[nr - 1].line = pairs[i].line;
+                pairs[nr - 1].lines++;
+            }
+        }
+        else
+            pairs[nr++] = pairs[i];
+    }
+    sort_array(pairs, nr, sizeof(struct share_pair), share_cmp_lines);
+
+    fprintf(stderr, PPREFIX "false sharing: %'lld of %'lld cache lines with"
+            " live blocks hold blocks of different threads\n",
+            (long long)shared, (long long)lines);
+
+    for (i = 0; i < nr && i < report_top; ++i)
+    {
+#if MALLOC_COUNT_SITES
+        fprintf(stderr, PPREFIX "  %'lld lines: %s  with  %s\n",
+                (long long)pairs[i].lines,
+                site_name(pairs[i].a, name_a, sizeof(name_a)),
+                site_name(pairs[i].b, name_b, sizeof(name_b)));
+#else
+        fprintf(stderr, PPREFIX "  %'lld lines (compile with"
+                " MALLOC_COUNT_SITES for call sites)\n",
+                (long long)pairs[i].lines);
+#endif
+    }
+
+    munmap(pairs, pairs_bytes);
+    if (blocks) munmap(blocks, bytes);
+#else
+    fprintf(stderr, PPREFIX "false sharing report requires"
+            " MALLOC_COUNT_LIVE !!!\n");
+#endif
+}
+
+/**************************************************/
+/* pages of large blocks which were never touched */
+/**************************************************/
+
+#if MALLOC_COUNT_UNTOUCHED
+
+/* blocks of at least this size are checked */
+static const size_t untouched_threshold = 256 * 1024;
+
+/* pages of the checked blocks of a site */
+struct untouched_site
+{
+    unsigned int site;
+    long long blocks, pages, untouched;
+};
+
+/* statistics of freed blocks per site */
+static struct untouched_site untouched_freed[SITES_MAX];
+
+/* count the whole pages of [ptr, ptr+size) and those not resident */
+static void untouched_measure(const void* ptr, size_t size,
+                              long long* pages, long long* untouched)
+{
+    static uintptr_t page = 0;
+    unsigned char vec[256];
+    uintptr_t begin, end;
+    size_t n, i;
+
+    if (!page) page = sysconf(_SC_PAGESIZE);
+
+    begin = ((uintptr_t)ptr + page - 1) / page * page;
+    end = ((uintptr_t)ptr + size) / page * page;
+
+    while (begin < end)
+    {
+        n = (end - begin) / page;
+        if (n > sizeof(vec)) n = sizeof(vec);
+        if (mincore((void*)begin, n * page, vec) != 0) return;
+
+        for (i = 0; i < n; ++i) *untouched += !(vec[i] & 1);
+        *pages += n;
+        begin += n * page;
+    }
+}
+
+/* check a large block which is about to be freed */
+static void untouched_free(const struct live_block* b)
+{
+    struct untouched_site* u = &untouched_freed[b->site];
+    long long pages = 0, untouched = 0;
+    SELF_DECL(ts)
+
+    if (b->size < untouched_threshold) return;
+    SELF_BEGIN(ts);
+
+    untouched_measure(b->ptr, b->size, &pages, &untouched);
+    __sync_add_and_fetch(&u->blocks, 1);
+    __sync_add_and_fetch(&u->pages, pages);
+    __sync_add_and_fetch(&u->untouched, untouched);
+
+    SELF_END(SELF_UNTOUCHED, ts);
+}
+
+static int untouched_cmp(const void* x, const void* y)
+{
+    const struct untouched_site* p = (const struct untouched_site*)x;
+    const struct untouched_site* q = (const struct untouched_site*)y;
+    return p->untouched > q->untouched ? -1 : p->untouched < q->untouched;
+}
+
+#endif /* MALLOC_COUNT_UNTOUCHED */
+
+/* user function which prints per site the fraction of pages of large blocks
+ * that were never touched, of the freed and the currently live blocks */
+extern void malloc_count_print_untouched(void)
+{
+#if MALLOC_COUNT_UNTOUCHED
+    struct live_block* blocks;
+    struct untouched_site* stats;
+    size_t num, bytes, i, n;
+    long long pages = 0, untouched = 0;
+    char name[512];
+
+    stats = (struct untouched_site*)
+        mmap(NULL, sizeof(untouched_freed), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) return;
+
+    memcpy(stats, untouched_freed, sizeof(untouched_freed));
+    for (i = 0; i < SITES_MAX; ++i) stats[i].site = i;
+
+    /* add the live blocks as of now */
+    num = live_snapshot(&blocks, &bytes);
+    for (i = 0; i < num; ++i) {
+        if (blocks[i].size < untouched_threshold) continue;
+        ++stats[blocks[i].site].blocks;
+        untouched_measure(blocks[i].ptr, blocks[i].size,
+                          &stats[blocks[i].site].pages,
+                          &stats[blocks[i].site].untouched);
+    }
+    if (blocks) munmap(blocks, bytes);
+
+    for (i = 0; i < SITES_MAX; ++i) {
+        pages += stats[i].pages;
+        untouched += stats[i].untouched;
+    }
+    sort_array(stats, SITES_MAX, sizeof(struct untouched_site), untouched_cmp);
+
+    fprintf(stderr, PPREFIX "untouched: %'lld of %'lld pages (%.1f%%) of"
+            " blocks >= %'lld bytes were never touched\n",
+            untouched, pages, pages ? 100.0 * untouched / pages : 0.0,
+            (long long)untouched_threshold);
+
+    for (i = 0, n = 0; i < SITES_MAX && n < report_top; ++i)
+    {
+        if (!stats[i].untouched) break;
+        fprintf(stderr, PPREFIX "  %5.1f%% of %'lld pages in %'lld blocks"
+                " untouched: %s\n",
+                100.0 * stats[i].untouched / stats[i].pages,
+                stats[i].pages, stats[i].blocks,
+                site_name(stats[i].site, name, sizeof(name)));
+        ++n;
+    }
+
+    munmap(stats, sizeof(untouched_freed));
+#else
+    fprintf(stderr, PPREFIX "untouched page report requires"
+            " MALLOC_COUNT_UNTOUCHED !!!\n");
+#endif
+}
+
+/*********************************************/
+/* duplicate and zero content of live blocks */
+/*********************************************/
+
+#if MALLOC_COUNT_SITES
+
+/* blocks whose 8 byte words are at least this fraction zero are reported */
+static const double zero_threshold = 0.9;
+
+/* content of one sampled block */
+struct content_entry
+{
+    unsigned long long hash;
+    const void* ptr;
+    size_t size;
+    unsigned int site;
+    int zero;                   /* mostly zero */
+    int grouped;                /* compared equal to an earlier entry */
+};
+
+/* group of blocks with identical content */
+struct content_group
+{
+    unsigned long long hash;
+    size_t size, count;
+    unsigned int site;          /* site of the first block of the group */
+};
+
+/* content statistics of the sampled blocks of a site */
+struct content_site
+{
+    unsigned int site;
+    long long blocks, bytes, dup_blocks, dup_bytes, zero_blocks, zero_bytes;
+};
+
+static unsigned long long content_rotl(unsigned long long x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* hash the content of a block in four independent lanes of 8 byte words,
+ * which keeps the multipliers busy in parallel, and count the zero words. */
+static unsigned long long content_hash(const unsigned char* p, size_t size,
+                                       size_t* zero_words)
+{
+    const unsigned long long P1 = 0x9E3779B185EBCA87ULL;
+    const unsigned long long P2 = 0xC2B2AE3D27D4EB4FULL;
+    unsigned long long a = P1 + P2, b = P2, c = 0, d = 0 - P1, w[4], h;
+    size_t i, k, zeros = 0;
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+        memcpy(w, p + i, 32);
+        zeros += (w[0] == 0) + (w[1] == 0) + (w[2] == 0) + (w[3] == 0);
+        a = content_rotl(a + w[0] * P2, 31) * P1;
+        b = content_rotl(b + w[1] * P2, 31) * P1;
+        c = content_rotl(c + w[2] * P2, 31) * P1;
+        d = content_rotl(d + w[3] * P2, 31) * P1;
+    }
+
+    h = content_rotl(a, 1) + content_rotl(b, 7) + content_rotl(c, 12)
+        + content_rotl(d, 18) + size;
+
+    for ( ; i < size; i += 8)
+    {
+        k = size - i < 8 ? size - i : 8;
+        w[0] = 0;
+        memcpy(w, p + i, k);
+        zeros += (w[0] == 0);
+        h = content_rotl(h ^ (w[0] * P2), 27) * P1;
+    }
+
+    h ^= h >> 33, h *= P2, h ^= h >> 29;
+    *zero_words = zeros;
+    return h;
+}
+
+/* check with mincore() that all pages of [ptr, ptr+size) are resident, so
+ * that reading the block neither faults in untouched pages nor swaps */
+static int content_resident(const void* ptr, size_t size)
+{
+    static uintptr_t page = 0;
+    unsigned char vec[256];
+    uintptr_t begin, end;
+    size_t n, i;
+
+    if (!page) page = sysconf(_SC_PAGESIZE);
+
+    begin = (uintptr_t)ptr / page * page;
+    end = ((uintptr_t)ptr + size + page - 1) / page * page;
+
+    while (begin < end)
+    {
+        n = (end - begin) / page;
+        if (n > sizeof(vec)) n = sizeof(vec);
+        if (mincore((void*)begin, n * page, vec) != 0) return 0;
+
+        for (i = 0; i < n; ++i) {
+            if (!(vec[i] & 1)) return 0;
+        }
+        begin += n * page;
+    }
+    return 1;
+}
+
+static int content_cmp_hash(const void* x, const void* y)
+{
+    const struct content_entry* p = (const struct content_entry*)x;
+    const struct content_entry* q = (const struct content_entry*)y;
+    if (p->hash != q->hash) return p->hash < q->hash ? -1 : 1;
+    return p->size < q->size ? -1 : p->size > q->size;
+}
+
+static int content_cmp_group(const void* x, const void* y)
+{
+    const struct content_group* p = (const struct content_group*)x;
+    const struct content_group* q = (const struct content_group*)y;
+    size_t wp = (p->count - 1) * p->size, wq = (q->count - 1) * q->size;
+    return wp > wq ? -1 : wp < wq;
+}
+
+static int content_cmp_site(const void* x, const void* y)
+{
+    const struct content_site* p = (const struct content_site*)x;
+    const struct content_site* q = (const struct content_site*)y;
+    long long wp = p->dup_bytes + p->zero_bytes;
+    long long wq = q->dup_bytes + q->zero_bytes;
+    return wp > wq ? -1 : wp < wq;
+}
+
+#endif /* MALLOC_COUNT_SITES */
+
+/* user function which hashes the content of every sample-th live block and
+ * prints groups of identical blocks and per site the bytes in duplicate and
+ * mostly zero blocks */
+extern void malloc_count_print_duplicates(size_t sample)
+{
+#if MALLOC_COUNT_SITES
+    struct live_block* blocks;
+    struct content_entry* entries;
+    struct content_group* groups;
+    struct content_site* stats;
+    size_t blocks_bytes, entries_bytes, groups_bytes;
+    size_t live, num = 0, ng = 0, i, j, k, n, count, zeros;
+    long long dup_bytes = 0, zero_bytes = 0, bytes = 0, skipped = 0;
+    char name[512];
+
+    if (sample == 0) sample = 1;
+
+    /* walk a snapshot, and hash each block under the lock after checking
+     * that it is still live, so that it cannot be freed while it is read.
+     * Allocations wait only for one block at a time. */
+    live = live_snapshot(&blocks, &blocks_bytes);
+    if (!blocks) return;
+
+    entries_bytes = (live / sample + 1) * sizeof(struct content_entry);
+    entries = (struct content_entry*)
+        mmap(NULL, entries_bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (entries == MAP_FAILED) {
+        munmap(blocks, blocks_bytes);
+        return;
+    }
+
+    for (i = 0; i < live; i += sample)
+    {
+        const struct live_block* b = &blocks[i];
+
+        spin_lock(&live_lock);
+        if (!live_contains(b->ptr, b->size)) {
+            spin_unlock(&live_lock);
+            continue;
+        }
+        if (!content_resident(b->ptr, b->size)) {
+            spin_unlock(&live_lock);
+            ++skipped;
+            continue;
+        }
+        entries[num].hash = content_hash((const unsigned char*)b->ptr,
+                                         b->size, &zeros);
+        spin_unlock(&live_lock);
+
+        entries[num].ptr = b->ptr;
+        entries[num].size = b->size;
+        entries[num].site = b->site;
+        entries[num].zero =
+            zeros >= zero_threshold * ((b->size + 7) / 8);
+        entries[num].grouped = 0;
+        ++num;
+    }
+
+    munmap(blocks, blocks_bytes);
+
+    groups_bytes = (num + 1) * sizeof(struct content_group);
+    groups = (struct content_group*)
+        mmap(NULL, groups_bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    stats = (struct content_site*)
+        mmap(NULL, SITES_MAX * sizeof(struct content_site),
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (groups == MAP_FAILED || stats == MAP_FAILED) {
+        munmap(entries, entries_bytes);
+        if (groups != MAP_FAILED) munmap(groups, groups_bytes);
+        if (stats != MAP_FAILED)
+            munmap(stats, SITES_MAX * sizeof(struct content_site));
+        return;
+    }
+    for (i = 0; i < SITES_MAX; ++i) stats[i].site = i;
+
+    /* blocks with equal hash and size are compared byte for byte, and all
+     * blocks of a group after the first are duplicates */
+    sort_array(entries, num, sizeof(struct content_entry), content_cmp_hash);
+
+    for (i = 0; i < num; i = j)
+    {
+        for (j = i + 1; j < num && entries[j].hash == entries[i].hash &&
+                 entries[j].size == entries[i].size; ++j) { }
+
+        for (n = i; n < j; ++n)
+        {
+            struct content_site* st = &stats[entries[n].site];
+            ++st->blocks;
+            st->bytes += entries[n].size;
+            bytes += entries[n].size;
+
+            if (entries[n].zero) {
+                ++st->zero_blocks;
+                st->zero_bytes += entries[n].size;
+                zero_bytes += entries[n].size;
+            }
+            if (entries[n].grouped) continue;
+
+            for (k = n + 1, count = 1; k < j; ++k)
+            {
+                int equal;
+                if (entries[k].grouped) continue;
+
+                /* both blocks must still be live to be compared */
+                spin_lock(&live_lock);
+                equal = live_contains(entries[n].ptr, entries[n].size) &&
+                    live_contains(entries[k].ptr, entries[k].size) &&
+                    memcmp(entries[n].ptr, entries[k].ptr,
+                           entries[n].size) == 0;
+                spin_unlock(&live_lock);
+                if (!equal) continue;
+
+                entries[k].grouped = 1;
+                ++count;
+                if (!entries[k].zero) {
+                    st = &stats[entries[k].site];
+                    ++st->dup_blocks;
+                    st->dup_bytes += entries[k].size;
+                    dup_bytes += entries[k].size;
+                }
+            }
+
+            if (count > 1 && !entries[n].zero) {
+                groups[ng].hash = entries[n].hash;
+                groups[ng].size = entries[n].size;
+                groups[ng].count = count;
+                groups[ng].site = entries[n].site;
+                ++ng;
+            }
+        }
+    }
+
+    sort_array(groups, ng, sizeof(struct content_group), content_cmp_group);
+    sort_array(stats, SITES_MAX, sizeof(struct content_site),
+               content_cmp_site);
+
+    fprintf(stderr, PPREFIX "content: sampled %'lld of %'lld live blocks"
+            " with %'lld bytes: %'lld bytes in duplicates, %'lld bytes in"
+            " mostly zero blocks, %'lld blocks not resident\n",
+            (long long)num, (long long)live, bytes, dup_bytes, zero_bytes,
+            skipped);
+
+    for (i = 0; i < ng && i < report_top; ++i) {
+        fprintf(stderr, PPREFIX "  %'lld identical blocks of %'lld bytes,"
+                " hash %016llx: %s\n",
+                (long long)groups[i].count, (long long)groups[i].size,
+                groups[i].hash,
+                site_name(groups[i].site, name, sizeof(name)));
+    }
+    for (i = 0; i < SITES_MAX && i < report_top; ++i) {
+        if (!stats[i].dup_bytes && !stats[i].zero_bytes) break;
+        fprintf(stderr, PPREFIX "  site with %'lld duplicate bytes in %'lld"
+                " blocks, %'lld zero bytes in %'lld blocks, of %'lld bytes:"
+                " %s\n", stats[i].dup_bytes, stats[i].dup_blocks,
+                stats[i].zero_bytes, stats[i].zero_blocks, stats[i].bytes,
+                site_name(stats[i].site, name, sizeof(name)));
+    }
+
+    munmap(entries, entries_bytes);
+    munmap(groups, groups_bytes);
+    munmap(stats, SITES_MAX * sizeof(struct content_site));
+#else
+    (void)sample;
+    fprintf(stderr, PPREFIX "content report requires"
+            " MALLOC_COUNT_SITES !!!\n");
+#endif
+}
+
+/*********************************************************/
+/* churn: total bytes against peak live bytes, per site and tag */
+/*********************************************************/
+
+#if MALLOC_COUNT_CHURN
+
+/* number of possible tags */
+#define CHURN_TAGS      65536
+
+/* allocator use of a site or tag */
+struct churn_stats
+{
+    /* site or tag in sorted copies, in churn_tags 1 once the tag is listed */
+    volatile unsigned int key;
+    long long allocs, total, live, peak, time_ns;
+};
+
+static struct churn_stats churn_sites[SITES_MAX];
+
+/* the default tag 0, and the other tags in a table which is mapped when the
+ * first one is used, followed by the list of used tags in order of use */
+static struct churn_stats churn_tag0;
+static struct churn_stats* churn_tags = NULL;
+static unsigned int* churn_tags_list = NULL;
+static volatile unsigned int churn_tags_num = 0;
+static volatile int churn_tags_lock = 0;
+
+static const size_t churn_tags_bytes =
+    CHURN_TAGS * (sizeof(struct churn_stats) + sizeof(unsigned int));
+
+/* return the counters of tag, or NULL if the table cannot be mapped */
+static struct churn_stats* churn_tag(unsigned int tag)
+{
+    struct churn_stats* c;
+    void* map;
+
+    tag %= CHURN_TAGS;
+    if (tag == 0) return &churn_tag0;
+
+    if (!churn_tags)
+    {
+        spin_lock(&churn_tags_lock);
+        if (!churn_tags) {
+            map = mmap(NULL, churn_tags_bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (map != MAP_FAILED) {
+                churn_tags_list = (unsigned int*)
+                    ((struct churn_stats*)map + CHURN_TAGS);
+                __sync_synchronize();
+                churn_tags = (struct churn_stats*)map;
+            }
+        }
+        spin_unlock(&churn_tags_lock);
+        if (!churn_tags) return NULL;
+    }
+
+    c = &churn_tags[tag];
+    if (!c->key && __sync_bool_compare_and_swap(&c->key, 0, 1))
+        churn_tags_list[__sync_fetch_and_add(&churn_tags_num, 1)] = tag;
+    return c;
+}
+
+/* time of init(), for the allocation rates */
+static long long churn_start = 0;
+
+static void churn_account(struct churn_stats* c, long long bytes,
+                          long long ns)
+{
+    long long mylive = __sync_add_and_fetch(&c->live, bytes), mypeak;
+    if (bytes > 0) {
+        __sync_add_and_fetch(&c->allocs, 1);
+        __sync_add_and_fetch(&c->total, bytes);
+        while ((mypeak = c->peak) < mylive &&
+               !__sync_bool_compare_and_swap(&c->peak, mypeak, mylive)) { }
+    }
+    __sync_add_and_fetch(&c->time_ns, ns);
+}
+
+/* account an allocation (bytes > 0) or a free (bytes < 0) of a block with
+ * the site and tag of its prefix, which took ns in the allocator */
+static void churn_count(unsigned int site, unsigned int tag,
+                        long long bytes, long long ns)
+{
+    struct churn_stats* c;
+    SELF_DECL(ts)
+    SELF_BEGIN(ts);
+    churn_account(&churn_sites[site % SITES_MAX], bytes, ns);
+    if ((c = churn_tag(tag)) != NULL) churn_account(c, bytes, ns);
+    SELF_END(SELF_CHURN, ts);
+}
+
+/* account a logical allocation of a custom pool. Its free carries no site or
+ * tag, so only the allocations and total bytes are counted. */
+static void churn_count_pool(unsigned int site, unsigned int tag,
+                             long long bytes)
+{
+    struct churn_stats* c = &churn_sites[site % SITES_MAX];
+    __sync_add_and_fetch(&c->allocs, 1);
+    __sync_add_and_fetch(&c->total, bytes);
+    if ((c = churn_tag(tag)) == NULL) return;
+    __sync_add_and_fetch(&c->allocs, 1);
+    __sync_add_and_fetch(&c->total, bytes);
+}
+
+static int churn_cmp(const void* x, const void* y)
+{
+    const struct churn_stats* p = (const struct churn_stats*)x;
+    const struct churn_stats* q = (const struct churn_stats*)y;
+    return p->time_ns > q->time_ns ? -1 : p->time_ns < q->time_ns;
+}
+
+/* print the top entries of a sorted copy of stats */
+static void churn_print(struct churn_stats* stats, size_t n, int sites,
+                        long long time_ns, double seconds)
+{
+    size_t i;
+    char name[512];
+
+    fprintf(stderr, PPREFIX "  %6s %10s %12s %10s %16s %14s %10s  %s\n",
+            "time%", "time_s", "allocs", "allocs/s", "total",
+            "peak_live", "churn", sites ? "site" : "tag");
+
+    for (i = 0; i < n && i < report_top; ++i)
+    {
+        const struct churn_stats* c = &stats[i];
+        if (!c->allocs) break;
+
+        if (sites)
+            site_name(c->key, name, sizeof(name));
+        else
+            sprintf(name, "%u", c->key);
+
+        fprintf(stderr, PPREFIX "  %5.1f%% %10.6f %'12lld %'10.0f %'16lld"
+                " %'14lld %10.1f  %s\n",
+                time_ns ? 100.0 * c->time_ns / time_ns : 0.0,
+                c->time_ns / 1e9, c->allocs, c->allocs / seconds, c->total,
+                c->peak, c->peak ? (double)c->total / c->peak : 0.0, name);
+    }
+}
+
+#endif /* MALLOC_COUNT_CHURN */
+
+/* user function which prints the sites and tags with the most time spent in
+ * the allocator, with their allocation rate and churn ratio, i.e. the total
+ * bytes allocated over the peak of the live bytes */
+extern void malloc_count_print_churn(void)
+{
+#if MALLOC_COUNT_CHURN
+    struct churn_stats* stats;
+    size_t num = churn_tags_num, bytes, i, n;
+    long long time_ns = 0, allocs = 0;
+    double seconds = (timestamp_ns() - churn_start) / 1e9;
+
+    if (seconds <= 0) seconds = 1e-9;
+
+    bytes = (num + 1 > SITES_MAX ? num + 1 : SITES_MAX)
+        * sizeof(struct churn_stats);
+    stats = (struct churn_stats*)
+        mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) return;
+
+    memcpy(stats, churn_sites, sizeof(churn_sites));
+    for (i = 0; i < SITES_MAX; ++i) {
+        stats[i].key = i;
+        time_ns += stats[i].time_ns;
+        allocs += stats[i].allocs;
+    }
+    sort_array(stats, SITES_MAX, sizeof(struct churn_stats), churn_cmp);
+
+    fprintf(stderr, PPREFIX "churn: %'lld allocations, %'.0f per second"
+            " over %.3f s, %.6f s in the allocator\n",
+            allocs, allocs / seconds, seconds, time_ns / 1e9);
+    fprintf(stderr, PPREFIX "churn by site:\n");
+    churn_print(stats, SITES_MAX, 1, time_ns, seconds);
+
+    /* only the used tags, a list entry may not be written yet */
+    stats[0] = churn_tag0;
+    stats[0].key = 0;
+    for (i = 0, n = 1; i < num; ++i) {
+        if (!churn_tags_list[i]) continue;
+        stats[n] = churn_tags[churn_tags_list[i]];
+        stats[n++].key = churn_tags_list[i];
+    }
+    sort_array(stats, n, sizeof(struct churn_stats), churn_cmp);
+
+    fprintf(stderr, PPREFIX "churn by tag:\n");
+    churn_print(stats, n, 0, time_ns, seconds);
+
+    munmap(stats, bytes);
+#else
+    fprintf(stderr, PPREFIX "churn report requires"
+            " MALLOC_COUNT_CHURN !!!\n");
+#endif
+}
+
+/***************************************************/
+/* pairs of allocating and freeing sites of blocks */
+/***************************************************/
+
+#if MALLOC_COUNT_PAIRS
+
+/* every this many allocations of a thread one is sampled */
+static const unsigned int pairs_sample_every = 64;
+
+/* countdown to the next sampled allocation of a thread */
+static __thread unsigned int pairs_countdown = 0;
+
+/* number of distinct pairs kept, further ones are dropped */
+#define PAIRS_MAX       8192
+
+/* freed sampled blocks of an allocating and freeing site */
+struct site_pair
+{
+    volatile unsigned int key;  /* 1 + alloc site * SITES_MAX + free site */
+    long long count, bytes, cross;
+};
+
+static struct site_pair pairs[PAIRS_MAX];
+static long long pairs_dropped = 0;
+
+/* flags for the prefix of a new block, sampling every n-th allocation */
+static unsigned int pairs_sample(void)
+{
+    if (pairs_countdown) {
+        --pairs_countdown;
+        return 0;
+    }
+    pairs_countdown = pairs_sample_every - 1;
+    return PREFIX_FLAG_SAMPLED;
+}
+
+/* record the site freeing a sampled block, and whether the allocating
+ * thread differs */
+static void pairs_free(const void* block, size_t size, void* caller)
+{
+    unsigned int key, h, i;
+    SELF_DECL(ts)
+
+    if (!(prefix_flags(block) & PREFIX_FLAG_SAMPLED)) return;
+    SELF_BEGIN(ts);
+
+    key = 1 + (prefix_site(block) % SITES_MAX) * SITES_MAX
+        + site_capture(caller);
+    h = (key * 2654435761u) % PAIRS_MAX;
+
+    for (i = 0; i < PAIRS_MAX; ++i, h = (h + 1) % PAIRS_MAX)
+    {
+        if (pairs[h].key == 0)
+            __sync_bool_compare_and_swap(&pairs[h].key, 0, key);
+
+        if (pairs[h].key == key)
+        {
+            __sync_add_and_fetch(&pairs[h].count, 1);
+            __sync_add_and_fetch(&pairs[h].bytes, size);
+            if (prefix_thread(block) != (get_thread_id() & 0xFFFF))
+                __sync_add_and_fetch(&pairs[h].cross, 1);
+            SELF_END(SELF_PAIRS, ts);
+            return;
+        }
+    }
+
+    __sync_add_and_fetch(&pairs_dropped, 1);
+    SELF_END(SELF_PAIRS, ts);
+}
+
+static int pairs_cmp(const void* x, const void* y)
+{
+    const struct site_pair* p = (const struct site_pair*)x;
+    const struct site_pair* q = (const struct site_pair*)y;
+    return p->bytes > q->bytes ? -1 : p->bytes < q->bytes;
+}
+
+#define PAIRS_SAMPLE()          pairs_sample()
+
+#else
+
+#define PAIRS_SAMPLE()          0
+
+#endif /* MALLOC_COUNT_PAIRS */
+
+/* user function which prints the pairs of allocating and freeing call sites
+ * of the sampled blocks with the most bytes, and how many were freed by
+ * another thread than the allocating one */
+extern void malloc_count_print_pairs(void)
+{
+#if MALLOC_COUNT_PAIRS
+    struct site_pair* stats;
+    size_t i;
+    long long count = 0, cross = 0;
+    char aname[512], fname[512];
+
+    stats = (struct site_pair*)
+        mmap(NULL, sizeof(pairs), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) return;
+
+    memcpy(stats, pairs, sizeof(pairs));
+    for (i = 0; i < PAIRS_MAX; ++i) {
+        count += stats[i].count;
+        cross += stats[i].cross;
+    }
+    sort_array(stats, PAIRS_MAX, sizeof(struct site_pair), pairs_cmp);
+
+    fprintf(stderr, PPREFIX "pairs: %'lld sampled blocks (1 in %u) freed,"
+            " %.1f%% by another thread, %'lld dropped\n",
+            count, pairs_sample_every, count ? 100.0 * cross / count : 0.0,
+            pairs_dropped);
+
+    for (i = 0; i < PAIRS_MAX && i < report_top; ++i)
+    {
+        unsigned int key = stats[i].key - 1;
+        if (!stats[i].count) break;
+
+        fprintf(stderr, PPREFIX "  ~%'lld blocks, ~%'lld bytes,"
+                " %.1f%% cross-thread\n"
+                PPREFIX "    allocated at %s\n"
+                PPREFIX "    freed at %s\n",
+                stats[i].count * pairs_sample_every,
+                stats[i].bytes * pairs_sample_every,
+                100.0 * stats[i].cross / stats[i].count,
+                site_name(key / SITES_MAX, aname, sizeof(aname)),
+                site_name(key % SITES_MAX, fname, sizeof(fname)));
+    }
+
+    munmap(stats, sizeof(pairs));
+#else
+    fprintf(stderr, PPREFIX "site pair report requires"
+            " MALLOC_COUNT_PAIRS !!!\n");
+#endif
+}
+
+/***********************************************************/
+/* logical allocations reported by custom pools and arenas */
+/***********************************************************/
+
+/* maximum number of pools, further ones are not recorded */
+#define POOLS_MAX       256
+
+/* statistics of one pool */
+struct pool_stats
+{
+    char name[32];
+    int destroyed;
+    long long allocs, frees, total, live, peak;
+    long long reserved, reserved_peak, frag_peak;
+};
+
+static struct pool_stats pools[POOLS_MAX];
+static int pools_num = 0;
+static volatile int pools_lock = 0;
+
+/* raise *peak to value */
+static void pool_raise(long long* peak, long long value)
+{
+    long long mypeak;
+    while ((mypeak = *peak) < value &&
+           !__sync_bool_compare_and_swap(peak, mypeak, value)) { }
+}
+
+/* pool with number id, or NULL for invalid numbers */
+static struct pool_stats* pool_get(int id)
+{
+    if (id < 0 || id >= pools_num) return NULL;
+    return &pools[id];
+}
+
+/* user function to register a custom pool, returns its number or -1 */
+extern int malloc_count_pool_create(const char* name)
+{
+    int id = -1;
+
+    spin_lock(&pools_lock);
+    if (pools_num < POOLS_MAX) {
+        id = pools_num;
+        strncpy(pools[id].name, name ? name : "",
+                sizeof(pools[id].name) - 1);
+        __sync_synchronize();
+        pools_num = id + 1;
+    }
+    spin_unlock(&pools_lock);
+
+    if (id < 0) {
+        fprintf(stderr, PPREFIX "pool table full, %s is not recorded !!!\n",
+                name ? name : "");
+    }
+    return id;
+}
+
+/* user function to report bytes of backing memory taken (bytes > 0) or
+ * returned (bytes < 0) by a pool */
+extern void malloc_count_pool_reserve(int id, long long bytes)
+{
+    struct pool_stats* p = pool_get(id);
+    long long reserved;
+    if (!p) return;
+
+    reserved = __sync_add_and_fetch(&p->reserved, bytes);
+    pool_raise(&p->reserved_peak, reserved);
+    pool_raise(&p->frag_peak, reserved - p->live);
+}
+
+/* user function to report a logical allocation carved out of a pool */
+extern void malloc_count_pool_alloc(int id, const void* ptr, size_t size)
+{
+    struct pool_stats* p = pool_get(id);
+    long long live;
+    if (!p) return;
+
+    inc_total(size);
+    __sync_add_and_fetch(&p->allocs, 1);
+    __sync_add_and_fetch(&p->total, size);
+    live = __sync_add_and_fetch(&p->live, size);
+    pool_raise(&p->peak, live);
+
+#if MALLOC_COUNT_CHURN
+    churn_count_pool(site_capture(__builtin_return_address(0)), tag_curr,
+                     size);
+#endif
+#if MALLOC_COUNT_EVENTS
+    emit_event(MALLOC_COUNT_EVENT_POOL_ALLOC, ptr, size);
+#endif
+    (void)ptr;
+}
+
+/* user function to report that a logical allocation went back to its pool */
+extern void malloc_count_pool_free(int id, const void* ptr, size_t size)
+{
+    struct pool_stats* p = pool_get(id);
+    long long live;
+    if (!p) return;
+
+    __sync_add_and_fetch(&p->frees, 1);
+    live = __sync_sub_and_fetch(&p->live, size);
+    pool_raise(&p->frag_peak, p->reserved - live);
+
+#if MALLOC_COUNT_EVENTS
+    emit_event(MALLOC_COUNT_EVENT_POOL_FREE, ptr, size);
+#endif
+    (void)ptr;
+}
+
+/* user function to report that a pool released all its memory. Its
+ * statistics are kept for the report. */
+extern void malloc_count_pool_destroy(int id)
+{
+    struct pool_stats* p = pool_get(id);
+    if (!p) return;
+
+    p->live = 0;
+    p->reserved = 0;
+    p->destroyed = 1;
+}
+
+/* user function which prints the logical allocations of all pools and their
+ * fragmentation, i.e. the reserved bytes not handed out */
+extern void malloc_count_print_pools(void)
+{
+    int i, num = pools_num;
+    long long allocs = 0, live = 0, reserved = 0;
+
+    for (i = 0; i < num; ++i) {
+        allocs += pools[i].allocs;
+        live += pools[i].live;
+        reserved += pools[i].reserved;
+    }
+
+    fprintf(stderr, PPREFIX "pools: %d pools, %'lld logical allocations,"
+            " live %'lld of %'lld reserved bytes, fragmentation %'lld"
+            " bytes (%.1f%%)\n",
+            num, allocs, live, reserved, reserved - live,
+            reserved ? 100.0 * (reserved - live) / reserved : 0.0);
+
+    if (!num) return;
+
+    fprintf(stderr, PPREFIX "  %12s %16s %14s %14s %14s %14s %6s %14s"
+            " %10s  %s\n",
+            "allocs", "total", "live", "peak_live", "reserved",
+            "frag", "frag%", "peak_frag", "churn", "pool");
+
+    for (i = 0; i < num; ++i)
+    {
+        const struct pool_stats* p = &pools[i];
+        long long frag = p->reserved - p->live;
+
+        fprintf(stderr, PPREFIX "  %'12lld %'16lld %'14lld %'14lld %'14lld"
+                " %'14lld %5.1f%% %'14lld %10.1f  %s%s\n",
+                p->allocs, p->total, p->live, p->peak, p->reserved, frag,
+                p->reserved ? 100.0 * frag / p->reserved : 0.0, p->frag_peak,
+                p->peak ? (double)p->total / p->peak : 0.0, p->name,
+                p->destroyed ? " (destroyed)" : "");
+    }
+}
+
+/*******************************************************************/
+/* phases of the program: before main(), startup, run and shutdown */
+/*******************************************************************/
+
+#if MALLOC_COUNT_PHASES
+
+/* phases, switched by the start of main(), malloc_count_mark_ready(), and
+ * malloc_count_mark_shutdown(), exit handlers or the return of main() */
+enum { PHASE_PREMAIN, PHASE_STARTUP, PHASE_RUN, PHASE_SHUTDOWN, PHASES };
+
+static const char* phase_name[PHASES] = {
+    "pre-main", "startup", "run", "shutdown"
+};
+
+/* allocator use of a phase or of a site in a phase, frees are attributed to
+ * the allocating site */
+struct phase_stats
+{
+    unsigned int key;           /* site, set in sorted copies */
+    long long allocs, bytes, frees, freed, time_ns;
+};
+
+static struct phase_stats phases[PHASES];
+static struct phase_stats phase_sites[PHASES][SITES_MAX];
+
+/* current phase, and the time each phase began */
+static volatile int phase_curr = PHASE_PREMAIN;
+static long long phase_begin[PHASES];
+
+/* allocations served by the init heap, before init() loaded real_malloc */
+static long long phase_init_heap_allocs = 0, phase_init_heap_bytes = 0;
+
+/* note the time malloc_count was first entered as begin of the program */
+static void phase_loaded(void)
+{
+    if (!phase_begin[PHASE_PREMAIN])
+        phase_begin[PHASE_PREMAIN] = timestamp_ns();
+}
+
+/* switch to a later phase, only one thread wins each switch */
+static void phase_enter(int phase)
+{
+    long long now = timestamp_ns();
+    int curr;
+
+    while ((curr = phase_curr) < phase) {
+        if (__sync_bool_compare_and_swap(&phase_curr, curr, phase)) {
+            phase_begin[phase] = now;
+            return;
+        }
+    }
+}
+
+/* exit handler, which begins the shutdown phase when exit() is called */
+static void phase_exit(void)
+{
+    phase_enter(PHASE_SHUTDOWN);
+}
+
+/* account an allocation (bytes > 0) or a free (bytes < 0) of a block of
+ * site to the current phase, which took ns in the allocator */
+static void phase_count(unsigned int site, long long bytes, long long ns)
+{
+    int phase = phase_curr;
+    struct phase_stats* p = &phases[phase];
+    struct phase_stats* s = &phase_sites[phase][site % SITES_MAX];
+
+    if (bytes > 0) {
+        __sync_add_and_fetch(&p->allocs, 1);
+        __sync_add_and_fetch(&p->bytes, bytes);
+        __sync_add_and_fetch(&s->allocs, 1);
+        __sync_add_and_fetch(&s->bytes, bytes);
+    }
+    else {
+        __sync_add_and_fetch(&p->frees, 1);
+        __sync_add_and_fetch(&p->freed, -bytes);
+        __sync_add_and_fetch(&s->frees, 1);
+        __sync_add_and_fetch(&s->freed, -bytes);
+    }
+    __sync_add_and_fetch(&p->time_ns, ns);
+    __sync_add_and_fetch(&s->time_ns, ns);
+}
+
+typedef int (*main_type)(int, char**, char**);
+typedef int (*libc_start_main_type)(main_type, int, char**, void (*)(void),
+                                    void (*)(void), void (*)(void), void*);
+
+static main_type phase_real_main = NULL;
+
+/* main() as called by libc, which begins the startup phase, and the
+ * shutdown phase when main() returns. The exit handler registered here runs
+ * after those the program registers later, but before the destructors of
+ * static objects constructed before main(). */
+static int phase_main(int argc, char** argv, char** envp)
+{
+    int ret;
+    phase_enter(PHASE_STARTUP);
+    atexit(phase_exit);
+    ret = (*phase_real_main)(argc, argv, envp);
+    phase_enter(PHASE_SHUTDOWN);
+    return ret;
+}
+
+/* exported __libc_start_main symbol, which libc's _start calls with main()
+ * before running the static constructors. It passes phase_main() instead. */
+extern int __libc_start_main(main_type main, int argc, char** argv,
+                             void (*init)(void), void (*fini)(void),
+                             void (*rtld_fini)(void), void* stack_end)
+{
+    libc_start_main_type real;
+
+    phase_loaded();
+    real = (libc_start_main_type)dlsym(RTLD_NEXT, "__libc_start_main");
+    if (!real) {
+        fprintf(stderr, PPREFIX "error %s\n", dlerror());
+        exit(EXIT_FAILURE);
+    }
+
+    phase_real_main = main;
+    return (*real)(phase_main, argc, argv, init, fini, rtld_fini, stack_end);
+}
+
+static int phase_cmp(const void* x, const void* y)
+{
+    const struct phase_stats* p = (const struct phase_stats*)x;
+    const struct phase_stats* q = (const struct phase_stats*)y;
+    return p->allocs > q->allocs ? -1 : p->allocs < q->allocs;
+}
+
+/* order sites by time in the allocator, for the teardown */
+static int phase_cmp_time(const void* x, const void* y)
+{
+    const struct phase_stats* p = (const struct phase_stats*)x;
+    const struct phase_stats* q = (const struct phase_stats*)y;
+    return p->time_ns > q->time_ns ? -1 : p->time_ns < q->time_ns;
+}
+
+#endif /* MALLOC_COUNT_PHASES */
+
+/* user function to mark the end of the program's startup, allocations after
+ * it are reported in the run phase */
+extern void malloc_count_mark_ready(void)
+{
+#if MALLOC_COUNT_PHASES
+    phase_enter(PHASE_RUN);
+#endif
+}
+
+/* user function to mark the start of the program's shutdown, frees after it
+ * are reported as teardown cost */
+extern void malloc_count_mark_shutdown(void)
+{
+#if MALLOC_COUNT_PHASES
+    phase_enter(PHASE_SHUTDOWN);
+#endif
+}
+
+/* user function which prints per phase of the program the allocations, the
+ * time spent, and the sites with the most allocations, or for the shutdown
+ * the sites with the most time spent freeing */
+extern void malloc_count_print_phases(void)
+{
+#if MALLOC_COUNT_PHASES
+    struct phase_stats* stats;
+    long long now = timestamp_ns();
+    size_t i;
+    int ph;
+    char name[512];
+
+    stats = (struct phase_stats*)
+        mmap(NULL, sizeof(phase_sites[0]), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) return;
+
+    fprintf(stderr, PPREFIX "phases:%s\n", phase_begin[PHASE_STARTUP] ? "" :
+            " start of main() not seen, libc did not call __libc_start_main");
+    fprintf(stderr, PPREFIX "  %-10s %12s %12s %16s %12s %16s %12s\n",
+            "phase", "time_s", "allocs", "bytes", "frees", "freed",
+            "alloc_time_s");
+
+    for (ph = 0; ph < PHASES; ++ph)
+    {
+        const struct phase_stats* p = &phases[ph];
+        long long end = now;
+        int next;
+
+        if (ph > phase_curr) break;
+        if (!phase_begin[ph]) continue;   /* skipped phase */
+        for (next = ph + 1; next < PHASES; ++next) {
+            if (phase_begin[next]) { end = phase_begin[next]; break; }
+        }
 
-/* to each allocation additional data is added for bookkeeping. due to
- * alignment requirements, we can optionally add more than just one integer. */
-static const size_t alignment = 16; /* bytes (>= 2*sizeof(size_t)) */
+        fprintf(stderr, PPREFIX "  %-10s %12.6f %'12lld %'16lld %'12lld"
+                " %'16lld %12.6f\n", phase_name[ph],
+                phase_begin[ph] ? (end - phase_begin[ph]) / 1e9 : 0.0,
+                p->allocs, p->bytes, p->frees, p->freed, p->time_ns / 1e9);
+    }
+    fprintf(stderr, PPREFIX "  of pre-main: %'lld allocations with %'lld"
+            " bytes from the init heap\n",
+            phase_init_heap_allocs, phase_init_heap_bytes);
+    if (phase_curr == PHASE_SHUTDOWN) {
+        fprintf(stderr, PPREFIX "  of shutdown: teardown until exit took"
+                " %.6f s, %.6f s of it in free(), which skipping it would"
+                " save\n", (now - phase_begin[PHASE_SHUTDOWN]) / 1e9,
+                phases[PHASE_SHUTDOWN].time_ns / 1e9);
+    }
 
-/* function pointer to the real procedures, loaded using dlsym */
-typedef void* (*malloc_type)(size_t);
-typedef void  (*free_type)(void*);
-typedef void* (*realloc_type)(void*, size_t);
+    for (ph = 0; ph <= phase_curr && ph < PHASES; ++ph)
+    {
+        int teardown = (ph == PHASE_SHUTDOWN);
+        if (!(teardown ? phases[ph].frees : phases[ph].allocs)) continue;
+
+        memcpy(stats, phase_sites[ph], sizeof(phase_sites[ph]));
+        for (i = 0; i < SITES_MAX; ++i) stats[i].key = i;
+        sort_array(stats, SITES_MAX, sizeof(struct phase_stats),
+                   teardown ? phase_cmp_time : phase_cmp);
+
+        fprintf(stderr, PPREFIX "top sites of %s%s:\n", phase_name[ph],
+                teardown ? " by time, frees of blocks allocated there" : "");
+        fprintf(stderr, PPREFIX "  %12s %16s %12s %16s %12s  %s\n",
+                "allocs", "bytes", "frees", "freed", "time_s", "site");
+        for (i = 0; i < SITES_MAX && i < report_top; ++i)
+        {
+            if (!stats[i].allocs && !stats[i].frees) break;
+            fprintf(stderr, PPREFIX "  %'12lld %'16lld %'12lld %'16lld"
+                    " %12.6f  %s\n",
+                    stats[i].allocs, stats[i].bytes, stats[i].frees,
+                    stats[i].freed, stats[i].time_ns / 1e9,
+                    site_name(stats[i].key, name, sizeof(name)));
+        }
+    }
 
-static malloc_type real_malloc = NULL;
-static free_type real_free = NULL;
-static realloc_type real_realloc = NULL;
+    munmap(stats, sizeof(phase_sites[0]));
+#else
+    fprintf(stderr, PPREFIX "phase report requires"
+            " MALLOC_COUNT_PHASES !!!\n");
+#endif
+}
 
-/* a sentinel value prefixed to each allocation */
-static const size_t sentinel = 0xDEADC0DE;
+/**********************************************/
+/* geometric over-allocation of growth chains */
+/**********************************************/
 
-/* a simple memory heap for allocations prior to dlsym loading */
-#define INIT_HEAP_SIZE 1024*1024
-static char init_heap[INIT_HEAP_SIZE];
-static size_t init_heap_use = 0;
-static const int log_operations_init_heap = 0;
+#if MALLOC_COUNT_GROW
 
-/* output */
-#define PPREFIX "malloc_count ### "
+/* blocks grown by realloc() again are over-allocated by 1/grow_divisor of
+ * their size, but by at most grow_slack_max bytes */
+static const size_t grow_divisor = 2;
+static const size_t grow_slack_max = 64 * 1024 * 1024;
 
-/*****************************************/
-/* run-time memory allocation statistics */
-/*****************************************/
+/* number of blocks which started growing, reallocs served from the slack of
+ * an over-allocation, those of them which glibc would have moved, i.e. the
+ * copies avoided, and their bytes, over-allocating reallocs, and how many of
+ * those moved the block. A growth is taken to need a copy if it exceeds
+ * glibc's rounding and the last over-allocation of the block had to move it,
+ * as glibc otherwise extends blocks in place. */
+static long long grow_chains = 0, grow_served = 0;
+static long long grow_avoided = 0, grow_avoided_bytes = 0;
+static long long grow_over = 0, grow_moved = 0;
 
-static long long peak = 0, curr = 0, total = 0, num_allocs = 0;
+/* unused bytes of growing blocks, and their peak */
+static long long grow_slack = 0, grow_slack_peak = 0;
 
-static malloc_count_callback_type callback = NULL;
-static void* callback_cookie = NULL;
+/* unused bytes at the end of a real block holding size bytes */
+static long long grow_block_slack(void* block, size_t size)
+{
+    return (long long)(malloc_usable_size(block) - alignment - size);
+}
 
-/* add allocation to statistics */
-static void inc_count(size_t inc)
+/* usable size of a glibc chunk for request bytes without over-allocation:
+ * rounded up to 16 bytes with an 8 byte header, or to pages for requests
+ * above the default mmap threshold */
+static size_t grow_natural_usable(size_t request)
 {
-#if THREAD_SAFE_GCC_INTRINSICS
-    long long mycurr = __sync_add_and_fetch(&curr, inc);
-    if (mycurr > peak) peak = mycurr;
-    total += inc;
-    if (callback) callback(callback_cookie, mycurr);
-#else
-    if ((curr += inc) > peak) peak = curr;
-    total += inc;
-    if (callback) callback(callback_cookie, curr);
-#endif
-    ++num_allocs;
+    size_t chunk;
+    if (request >= 128 * 1024) {
+        chunk = (request + 2 * sizeof(size_t) + 4095) & ~(size_t)4095;
+        return chunk - 2 * sizeof(size_t);
+    }
+    chunk = (request + sizeof(size_t) + 15) & ~(size_t)15;
+    if (chunk < 32) chunk = 32;
+    return chunk - sizeof(size_t);
 }
 
-/* decrement allocation to statistics */
-static void dec_count(size_t dec)
+static void grow_add_slack(long long inc)
 {
-#if THREAD_SAFE_GCC_INTRINSICS
-    long long mycurr = __sync_sub_and_fetch(&curr, dec);
-    if (callback) callback(callback_cookie, mycurr);
-#else
-    curr -= dec;
-    if (callback) callback(callback_cookie, curr);
-#endif
+    long long myslack = __sync_add_and_fetch(&grow_slack, inc), mypeak;
+    while ((mypeak = grow_slack_peak) < myslack &&
+           !__sync_bool_compare_and_swap(&grow_slack_peak, mypeak, myslack)) { }
 }
 
-/* user function to return the currently allocated amount of memory */
-extern size_t malloc_count_current(void)
+/* replaces real_realloc() of a block growing from oldsize to size: the first
+ * growth flags the block in *flags, and further growths over-allocate it
+ * geometrically, or are served from the slack of an earlier over-allocation.
+ * Returns NULL and leaves the block unchanged if the allocator failed. */
+static void* grow_realloc(void* block, size_t oldsize, size_t size,
+                          unsigned int* flags)
 {
-    return curr;
+    unsigned int oldflags = prefix_flags(block);
+    int growing = (oldflags & PREFIX_FLAG_GROWING) != 0;
+    long long oldslack = growing ? grow_block_slack(block, oldsize) : 0;
+    size_t want = size;
+    void* newblock;
+
+    *flags = 0;
+    if (size > oldsize)
+    {
+        *flags = PREFIX_FLAG_GROWING;
+
+        if (!growing) {
+            __sync_add_and_fetch(&grow_chains, 1);
+        }
+        else if ((oldflags & PREFIX_FLAG_OVER) &&
+                 alignment + size <= malloc_usable_size(block))
+        {
+            __sync_add_and_fetch(&grow_served, 1);
+            /* glibc grows in place within its own rounding, and if the
+             * over-allocation found room after the block */
+            if ((oldflags & PREFIX_FLAG_MOVED) &&
+                alignment + size > grow_natural_usable(alignment + oldsize)) {
+                __sync_add_and_fetch(&grow_avoided, 1);
+                __sync_add_and_fetch(&grow_avoided_bytes, oldsize);
+            }
+            grow_add_slack(-(long long)(size - oldsize));
+            *flags |= oldflags & (PREFIX_FLAG_OVER | PREFIX_FLAG_MOVED);
+            return block;
+        }
+        else {
+            size_t extra = size / grow_divisor;
+            if (extra > grow_slack_max) extra = grow_slack_max;
+            if (size + extra <= PREFIX_SIZE_MAX) want = size + extra;
+        }
+    }
+
+    newblock = (*real_realloc)(block, alignment + want);
+    if (!newblock && want != size) {
+        want = size;
+        newblock = (*real_realloc)(block, alignment + size);
+    }
+    if (!newblock) return NULL;
+
+    if (want != size) {
+        *flags |= PREFIX_FLAG_OVER;
+        __sync_add_and_fetch(&grow_over, 1);
+        if (newblock != block) {
+            *flags |= PREFIX_FLAG_MOVED;
+            __sync_add_and_fetch(&grow_moved, 1);
+        }
+    }
+
+    grow_add_slack((*flags ? grow_block_slack(newblock, size) : 0) - oldslack);
+    return newblock;
 }
 
-/* user function to return the peak allocation */
-extern size_t malloc_count_peak(void)
+/* account the slack of a growing block which is freed */
+static void grow_free(void* block, size_t size)
 {
-    return peak;
+    if (prefix_flags(block) & PREFIX_FLAG_GROWING)
+        grow_add_slack(-grow_block_slack(block, size));
 }
 
-/* user function to reset the peak allocation to current */
-extern void malloc_count_reset_peak(void)
+#endif /* MALLOC_COUNT_GROW */
+
+/* user function which prints how many reallocs of growing blocks were served
+ * from the slack of geometric over-allocation, i.e. the copies avoided */
+extern void malloc_count_print_grow(void)
 {
-    peak = curr;
+#if MALLOC_COUNT_GROW
+    fprintf(stderr, PPREFIX "grow: %'lld growth chains, %'lld reallocs served"
+            " from slack, of which %'lld avoided copies of %'lld bytes,"
+            " %'lld over-allocations of which %'lld moved, slack %'lld bytes"
+            " (peak %'lld)\n",
+            grow_chains, grow_served, grow_avoided, grow_avoided_bytes,
+            grow_over, grow_moved, grow_slack, grow_slack_peak);
+#else
+    fprintf(stderr, PPREFIX "growth report requires"
+            " MALLOC_COUNT_GROW !!!\n");
+#endif
 }
 
-/* user function to return total number of allocations */
-extern size_t malloc_count_num_allocs(void)
+#if MALLOC_COUNT_LIVE
+
+/* remove a freed block from the table and run the analyses on it */
+static void live_free(void* ptr)
 {
-    return num_allocs;
+    struct live_block block;
+
+    if (!live_remove(ptr, &block)) return;
+
+#if MALLOC_COUNT_UNTOUCHED
+    untouched_free(&block);
+#endif
 }
 
-/* user function which prints current and peak allocation to stderr */
-extern void malloc_count_print_status(void)
+#endif /* MALLOC_COUNT_LIVE */
+
+/*******************************************/
+/* statistics including malloc_count's own */
+/*******************************************/
+
+/* size of the static tables and internal buffers of malloc_count */
+static size_t internal_bytes(void)
 {
-    fprintf(stderr, PPREFIX "current %'lld, peak %'lld\n",
-            curr, peak);
+    size_t bytes = sizeof(init_heap);
+#if MALLOC_COUNT_OMPT
+    bytes += sizeof(ompt_regions);
+#endif
+#if MALLOC_COUNT_LIVE
+    bytes += live_capacity * sizeof(struct live_block);
+#endif
+#if MALLOC_COUNT_PERCPU
+    bytes += sizeof(percpu_slots);
+#endif
+#if MALLOC_COUNT_CHURN
+    bytes += sizeof(churn_sites) + sizeof(churn_tag0);
+    if (churn_tags) bytes += churn_tags_bytes;
+#endif
+#if MALLOC_COUNT_PAIRS
+    bytes += sizeof(pairs);
+#endif
+#if MALLOC_COUNT_PHASES
+    bytes += sizeof(phases) + sizeof(phase_sites);
+#endif
+    bytes += sizeof(pools);
+#if MALLOC_COUNT_SELF_PROFILE
+    bytes += self_stream_bytes + self_trace_bytes;
+#endif
+    return bytes;
 }
 
-/* user function to supply a memory profile callback */
-void malloc_count_set_callback(malloc_count_callback_type cb, void* cookie)
+/* user function to fill in all statistics, including the overhead */
+extern void malloc_count_get_stats(struct malloc_count_stats* stats)
 {
-    callback = cb;
-    callback_cookie = cookie;
+    memset(stats, 0, sizeof(*stats));
+    COUNT_FOLD();
+    stats->current = curr;
+    stats->peak = peak;
+    stats->total = total;
+    stats->num_allocs = num_allocs;
+
+    stats->self_internal_bytes = internal_bytes();
+#if MALLOC_COUNT_SELF_PROFILE
+    stats->self_blocks = self_blocks;
+    stats->self_prefix_bytes = self_blocks * alignment;
+    stats->self_prefix_peak = self_blocks_peak * alignment;
+
+    stats->self_time_count = self_time_ns[SELF_COUNT] / 1e9;
+    stats->self_time_callback = self_time_ns[SELF_CALLBACK] / 1e9;
+    stats->self_time_log = self_time_ns[SELF_LOG] / 1e9;
+    stats->self_time_features =
+        (self_time_ns[SELF_OMPT] + self_time_ns[SELF_STREAM] +
+         self_time_ns[SELF_TRACE] + self_time_ns[SELF_LIVE] +
+         self_time_ns[SELF_SITES] + self_time_ns[SELF_UNTOUCHED] +
+         self_time_ns[SELF_CHURN] + self_time_ns[SELF_PAIRS]) / 1e9;
+    stats->self_time_clock = self_clock_reads * self_clock_ns / 1e9;
+#endif
 }
 
+#if MALLOC_COUNT_SELF_PROFILE
+
+/* print the overhead of malloc_count to stderr */
+static void self_print(void)
+{
+    long long sum = 0;
+    int i;
+
+    for (i = 0; i < SELF_PARTS; ++i) sum += self_time_ns[i];
+
+    fprintf(stderr, PPREFIX "self: time %.6f s (", sum / 1e9);
+    for (i = 0; i < SELF_PARTS; ++i) {
+        fprintf(stderr, "%s%s %.6f s", i ? ", " : "",
+                self_part_name[i], self_time_ns[i] / 1e9);
+    }
+    fprintf(stderr, "), of which %.6f s reading the clock\n",
+            self_clock_reads * self_clock_ns / 1e9);
+
+    fprintf(stderr, PPREFIX "self: prefixes %'lld bytes (peak %'lld),"
+            " internal tables and buffers %'lld bytes\n",
+            (long long)(self_blocks * alignment),
+            (long long)(self_blocks_peak * alignment),
+            (long long)internal_bytes());
+}
+
+#endif /* MALLOC_COUNT_SELF_PROFILE */
+
 /****************************************************/
 /* exported symbols that overlay the libc functions */
 /****************************************************/
 
-/* exported malloc symbol that overrides loading from libc */
-extern void* malloc(size_t size)
+/* allocate and account a block, called by the exported malloc() and calloc() */
+static void* do_malloc(size_t size, void* caller)
 {
     void* ret;
+    unsigned int site;
+    SELF_DECL(tlog)
+    (void)caller;
 
     if (size == 0) return NULL;
+    if (size > PREFIX_SIZE_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
 
     if (real_malloc)
     {
+#if MALLOC_COUNT_OMPT
+        struct ompt_region* region = ompt_region_curr;
+        long long ts = region ? timestamp_ns() : 0;
+#endif
+#if MALLOC_COUNT_ALLOC_TIME
+        long long talloc = timestamp_ns();
+#endif
         /* call read malloc procedure in libc */
         ret = (*real_malloc)(alignment + size);
+        if (!ret) return NULL;
+#if MALLOC_COUNT_ALLOC_TIME
+        talloc = timestamp_ns() - talloc;
+#endif
 
-        inc_count(size);
+        inc_count(size, 1);
+        SELF_BLOCK(1);
+#if MALLOC_COUNT_OMPT
+        if (region) ompt_region_count(region, size, timestamp_ns() - ts);
+#endif
         if (log_operations && size >= log_operations_threshold) {
+            SELF_BEGIN(tlog);
+            COUNT_FOLD();
             fprintf(stderr, PPREFIX "malloc(%'lld) = %p   (current %'lld)\n",
                     (long long)size, (char*)ret + alignment, curr);
+            SELF_END(SELF_LOG, tlog);
         }
 
-        /* prepend allocation size and check sentinel */
-        *(size_t*)ret = size;
-        *(size_t*)((char*)ret + alignment - sizeof(size_t)) = sentinel;
+        /* prepend allocation size, check, thread, tag and site */
+        site = SITE_CAPTURE(caller);
+        prefix_write(ret, size, get_thread_id(), PAIRS_SAMPLE(), site);
+#if MALLOC_COUNT_CHURN
+        churn_count(site, tag_curr, size, talloc);
+#endif
+#if MALLOC_COUNT_PHASES
+        phase_count(site, size, talloc);
+#endif
+
+#if MALLOC_COUNT_EVENTS
+        emit_event(MALLOC_COUNT_EVENT_ALLOC, (char*)ret + alignment, size);
+#endif
+#if MALLOC_COUNT_LIVE
+        live_insert((char*)ret + alignment, size, site);
+#endif
 
         return (char*)ret + alignment;
     }
@@ -181,9 +3401,15 @@ extern void* malloc(size_t size)
         ret = init_heap + init_heap_use;
         init_heap_use += alignment + size;
 
-        /* prepend allocation size and check sentinel */
-        *(size_t*)ret = size;
-        *(size_t*)((char*)ret + alignment - sizeof(size_t)) = sentinel;
+#if MALLOC_COUNT_PHASES
+        phase_loaded();
+        phase_count(0, size, 0);
+        ++phase_init_heap_allocs;
+        phase_init_heap_bytes += size;
+#endif
+
+        /* prepend allocation size and check */
+        prefix_write(ret, size, 0, PREFIX_FLAG_INIT_HEAP, 0);
 
         if (log_operations_init_heap) {
             fprintf(stderr, PPREFIX "malloc(%'lld) = %p   on init heap\n",
@@ -194,10 +3420,28 @@ extern void* malloc(size_t size)
     }
 }
 
+/* exported malloc symbol that overrides loading from libc */
+extern void* malloc(size_t size)
+{
+    return do_malloc(size, __builtin_return_address(0));
+}
+
 /* exported free symbol that overrides loading from libc */
 extern void free(void* ptr)
 {
     size_t size;
+    SELF_DECL(tlog)
+#if MALLOC_COUNT_CHURN
+    unsigned int tag;
+#endif
+#if MALLOC_COUNT_ALLOC_TIME
+    unsigned int site;
+    long long talloc;
+#endif
+#if MALLOC_COUNT_OMPT
+    struct ompt_region* region = ompt_region_curr;
+    long long ts = region ? timestamp_ns() : 0;
+#endif
 
     if (!ptr) return;   /* free(NULL) is no operation */
 
@@ -218,30 +3462,69 @@ extern void free(void* ptr)
 
     ptr = (char*)ptr - alignment;
 
-    if (*(size_t*)((char*)ptr + alignment - sizeof(size_t)) != sentinel) {
+    if (!prefix_valid(ptr)) {
         fprintf(stderr, PPREFIX
-                "free(%p) has no sentinel !!! memory corruption?\n", ptr);
+                "free(%p) has no valid prefix !!! memory corruption?\n", ptr);
     }
 
-    size = *(size_t*)ptr;
+    size = prefix_size(ptr);
     dec_count(size);
+    SELF_BLOCK(-1);
+#if MALLOC_COUNT_EVENTS
+    emit_event(MALLOC_COUNT_EVENT_FREE, (char*)ptr + alignment, size);
+#endif
+#if MALLOC_COUNT_LIVE
+    live_free((char*)ptr + alignment);
+#endif
+#if MALLOC_COUNT_PAIRS
+    pairs_free(ptr, size, __builtin_return_address(0));
+#endif
+#if MALLOC_COUNT_GROW
+    grow_free(ptr, size);
+#endif
 
     if (log_operations && size >= log_operations_threshold) {
+        SELF_BEGIN(tlog);
+        COUNT_FOLD();
         fprintf(stderr, PPREFIX "free(%p) -> %'lld   (current %'lld)\n",
                 ptr, (long long)size, curr);
+        SELF_END(SELF_LOG, tlog);
     }
 
+#if MALLOC_COUNT_CHURN
+    tag = prefix_tag(ptr);
+#endif
+#if MALLOC_COUNT_ALLOC_TIME
+    site = prefix_site(ptr);
+    talloc = timestamp_ns();
+#endif
+
     (*real_free)(ptr);
+
+#if MALLOC_COUNT_ALLOC_TIME
+    talloc = timestamp_ns() - talloc;
+#endif
+#if MALLOC_COUNT_CHURN
+    churn_count(site, tag, -(long long)size, talloc);
+#endif
+#if MALLOC_COUNT_PHASES
+    phase_count(site, -(long long)size, talloc);
+#endif
+#if MALLOC_COUNT_OMPT
+    if (region) ompt_region_count(region, -(long long)size, timestamp_ns() - ts);
+#endif
 }
 
 /* exported calloc() symbol that overrides loading from libc, implemented using
- * our malloc */
+ * our malloc. do_malloc() is called instead of malloc(), because gcc -O2
+ * otherwise folds malloc() + memset() into a call to calloc(), i.e. into an
+ * endless loop. */
 extern void* calloc(size_t nmemb, size_t size)
 {
     void* ret;
     size *= nmemb;
     if (!size) return NULL;
-    ret = malloc(size);
+    ret = do_malloc(size, __builtin_return_address(0));
     memset(ret, 0, size);
     return ret;
 }
@@ -251,6 +3534,18 @@ extern void* realloc(void* ptr, size_t size)
 {
     void* newptr;
     size_t oldsize;
+    unsigned int site, grow = 0;
+#if MALLOC_COUNT_LIVE
+    struct prefix oldprefix;
+#endif
+    SELF_DECL(tlog)
+#if MALLOC_COUNT_OMPT
+    struct ompt_region* region;
+    long long ts;
+#endif
+#if MALLOC_COUNT_ALLOC_TIME
+    long long talloc;
+#endif
 
     if ((char*)ptr >= (char*)init_heap &&
         (char*)ptr <= (char*)init_heap + init_heap_use)
@@ -261,17 +3556,17 @@ extern void* realloc(void* ptr, size_t size)
 
         ptr = (char*)ptr - alignment;
 
-        if (*(size_t*)((char*)ptr + alignment - sizeof(size_t)) != sentinel) {
+        if (!prefix_valid(ptr)) {
             fprintf(stderr, PPREFIX
-                    "realloc(%p) has no sentinel !!! memory corruption?\n",
+                    "realloc(%p) has no valid prefix !!! memory corruption?\n",
                     ptr);
         }
 
-        oldsize = *(size_t*)ptr;
+        oldsize = prefix_size(ptr);
 
         if (oldsize >= size) {
             /* keep old area, just reduce the size */
-            *(size_t*)ptr = size;
+            prefix_set_size(ptr, size);
             return (char*)ptr + alignment;
         }
         else {
@@ -293,22 +3588,90 @@ extern void* realloc(void* ptr, size_t size)
         return malloc(size);
     }
 
+    if (size > PREFIX_SIZE_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
     ptr = (char*)ptr - alignment;
 
-    if (*(size_t*)((char*)ptr + alignment - sizeof(size_t)) != sentinel) {
+    if (!prefix_valid(ptr)) {
         fprintf(stderr, PPREFIX
-                "free(%p) has no sentinel !!! memory corruption?\n", ptr);
+                "realloc(%p) has no valid prefix !!! memory corruption?\n",
+                ptr);
     }
 
-    oldsize = *(size_t*)ptr;
+    oldsize = prefix_size(ptr);
+#if MALLOC_COUNT_LIVE
+    /* the old block's attribution, for after it was released */
+    oldprefix = *(struct prefix*)ptr;
+#endif
 
-    dec_count(oldsize);
-    inc_count(size);
+#if MALLOC_COUNT_OMPT
+    region = ompt_region_curr;
+    ts = region ? timestamp_ns() : 0;
+#endif
+
+#if MALLOC_COUNT_EVENTS
+    /* publish before the old block can be reused by other threads */
+    emit_event(MALLOC_COUNT_EVENT_FREE, (char*)ptr + alignment, oldsize);
+#endif
+#if MALLOC_COUNT_LIVE
+    live_free((char*)ptr + alignment);
+#endif
+#if MALLOC_COUNT_ALLOC_TIME
+    talloc = timestamp_ns();
+#endif
 
+#if MALLOC_COUNT_GROW
+    newptr = grow_realloc(ptr, oldsize, size, &grow);
+#else
     newptr = (*real_realloc)(ptr, alignment + size);
+#endif
+
+#if MALLOC_COUNT_ALLOC_TIME
+    talloc = timestamp_ns() - talloc;
+#endif
+
+    if (!newptr) {
+        /* the old block is kept unchanged */
+#if MALLOC_COUNT_EVENTS
+        emit_event(MALLOC_COUNT_EVENT_ALLOC, (char*)ptr + alignment, oldsize);
+#endif
+#if MALLOC_COUNT_LIVE
+        live_insert((char*)ptr + alignment, oldsize, prefix_site(&oldprefix));
+#endif
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    dec_count(oldsize);
+    inc_count(size, 1);
+
+#if MALLOC_COUNT_PAIRS
+    pairs_free(&oldprefix, oldsize, __builtin_return_address(0));
+#endif
+
+    /* the old block is freed, the new one is charged the time */
+#if MALLOC_COUNT_CHURN
+    churn_count(prefix_site(&oldprefix), prefix_tag(&oldprefix),
+                -(long long)oldsize, 0);
+#endif
+#if MALLOC_COUNT_PHASES
+    phase_count(prefix_site(&oldprefix), -(long long)oldsize, 0);
+#endif
+
+#if MALLOC_COUNT_OMPT
+    if (region) {
+        ompt_region_count(region, -(long long)oldsize, 0);
+        ompt_region_count(region, size, timestamp_ns() - ts);
+    }
+#endif
 
     if (log_operations && size >= log_operations_threshold)
     {
+        SELF_BEGIN(tlog);
+        COUNT_FOLD();
         if (newptr == ptr)
             fprintf(stderr, PPREFIX
                     "realloc(%'lld -> %'lld) = %p   (current %'lld)\n",
@@ -317,19 +3680,216 @@ extern void* realloc(void* ptr, size_t size)
             fprintf(stderr, PPREFIX
                     "realloc(%'lld -> %'lld) = %p -> %p   (current %'lld)\n",
                    (long long)oldsize, (long long)size, ptr, newptr, curr);
+        SELF_END(SELF_LOG, tlog);
     }
 
-    *(size_t*)newptr = size;
+    /* the check depends on the address, the block is attributed anew */
+    site = SITE_CAPTURE(__builtin_return_address(0));
+    prefix_write(newptr, size, get_thread_id(), PAIRS_SAMPLE() | grow, site);
+#if MALLOC_COUNT_CHURN
+    churn_count(site, tag_curr, size, talloc);
+#endif
+#if MALLOC_COUNT_PHASES
+    phase_count(site, size, talloc);
+#endif
+
+#if MALLOC_COUNT_EVENTS
+    emit_event(MALLOC_COUNT_EVENT_ALLOC, (char*)newptr + alignment, size);
+#endif
+#if MALLOC_COUNT_LIVE
+    live_insert((char*)newptr + alignment, size, site);
+#endif
 
     return (char*)newptr + alignment;
 }
 
-static __attribute__((constructor)) void init(void)
+/* user function to allocate n blocks of size bytes into out[], which updates
+ * the counters and calls the callback once for the whole batch. Returns the
+ * number of blocks allocated, less than n if the allocator failed. */
+extern size_t malloc_count_bulk_alloc(size_t n, size_t size, void** out)
+{
+    size_t i;
+    unsigned int site, thread;
+    void* caller = __builtin_return_address(0);
+    long long ns = 0;
+    SELF_DECL(tlog)
+#if MALLOC_COUNT_OMPT
+    struct ompt_region* region = ompt_region_curr;
+#endif
+
+    if (!real_malloc || size == 0 || size > PREFIX_SIZE_MAX)
+    {
+        /* the init heap and errors are handled one by one */
+        for (i = 0; i < n; ++i) {
+            if (!(out[i] = do_malloc(size, caller))) break;
+        }
+        return i;
+    }
+
+#if MALLOC_COUNT_ALLOC_TIME || MALLOC_COUNT_OMPT
+    ns = timestamp_ns();
+#endif
+    for (i = 0; i < n; ++i) {
+        if (!(out[i] = (*real_malloc)(alignment + size))) break;
+    }
+    if (!(n = i)) return 0;
+#if MALLOC_COUNT_ALLOC_TIME || MALLOC_COUNT_OMPT
+    /* each block is charged an equal share of the time */
+    ns = (timestamp_ns() - ns) / n;
+#endif
+
+    inc_count(n * size, n);
+    SELF_BLOCK(n);
+
+    if (log_operations && n * size >= log_operations_threshold) {
+        SELF_BEGIN(tlog);
+        COUNT_FOLD();
+        fprintf(stderr, PPREFIX "bulk_alloc(%'lld x %'lld) = %p ...   "
+                "(current %'lld)\n", (long long)n, (long long)size,
+                (char*)out[0] + alignment, curr);
+        SELF_END(SELF_LOG, tlog);
+    }
+
+    /* all blocks of the batch share the call site */
+    site = SITE_CAPTURE(caller);
+    thread = get_thread_id();
+
+    for (i = 0; i < n; ++i)
+    {
+        prefix_write(out[i], size, thread, PAIRS_SAMPLE(), site);
+#if MALLOC_COUNT_CHURN
+        churn_count(site, tag_curr, size, ns);
+#endif
+#if MALLOC_COUNT_PHASES
+        phase_count(site, size, ns);
+#endif
+#if MALLOC_COUNT_OMPT
+        if (region) ompt_region_count(region, size, ns);
+#endif
+        out[i] = (char*)out[i] + alignment;
+#if MALLOC_COUNT_EVENTS
+        emit_event(MALLOC_COUNT_EVENT_ALLOC, out[i], size);
+#endif
+#if MALLOC_COUNT_LIVE
+        live_insert(out[i], size, site);
+#endif
+    }
+    (void)ns, (void)caller;
+
+    return n;
+}
+
+/* user function to free n blocks of ptrs[], which updates the counters and
+ * calls the callback once for the whole batch. NULL pointers are skipped. */
+extern void malloc_count_bulk_free(void** ptrs, size_t n)
+{
+    size_t i, bytes = 0, num = 0;
+    void* caller = __builtin_return_address(0);
+    SELF_DECL(tlog)
+#if MALLOC_COUNT_CHURN
+    unsigned int tag;
+#endif
+#if MALLOC_COUNT_ALLOC_TIME
+    unsigned int site;
+    long long talloc;
+#endif
+#if MALLOC_COUNT_OMPT
+    struct ompt_region* region = ompt_region_curr;
+#endif
+
+    for (i = 0; i < n; ++i)
+    {
+        char* ptr = (char*)ptrs[i];
+        size_t size;
+
+        if (!ptr) continue;
+
+        if (!real_free ||
+            (ptr >= init_heap && ptr <= init_heap + init_heap_use)) {
+            free(ptr);
+            continue;
+        }
+
+        ptr -= alignment;
+
+        if (!prefix_valid(ptr)) {
+            fprintf(stderr, PPREFIX "bulk_free(%p) has no valid prefix !!!"
+                    " memory corruption?\n", ptr);
+        }
+
+        size = prefix_size(ptr);
+#if MALLOC_COUNT_EVENTS
+        emit_event(MALLOC_COUNT_EVENT_FREE, ptr + alignment, size);
+#endif
+#if MALLOC_COUNT_LIVE
+        live_free(ptr + alignment);
+#endif
+#if MALLOC_COUNT_PAIRS
+        pairs_free(ptr, size, caller);
+#endif
+#if MALLOC_COUNT_GROW
+        grow_free(ptr, size);
+#endif
+#if MALLOC_COUNT_CHURN
+        tag = prefix_tag(ptr);
+#endif
+#if MALLOC_COUNT_ALLOC_TIME
+        site = prefix_site(ptr);
+        talloc = timestamp_ns();
+#endif
+
+        (*real_free)(ptr);
+
+#if MALLOC_COUNT_ALLOC_TIME
+        talloc = timestamp_ns() - talloc;
+#endif
+#if MALLOC_COUNT_CHURN
+        churn_count(site, tag, -(long long)size, talloc);
+#endif
+#if MALLOC_COUNT_PHASES
+        phase_count(site, -(long long)size, talloc);
+#endif
+#if MALLOC_COUNT_OMPT
+        if (region) ompt_region_count(region, -(long long)size, 0);
+#endif
+        bytes += size;
+        ++num;
+    }
+    (void)caller;
+
+    if (!num) return;
+
+    dec_count(bytes);
+    SELF_BLOCK(-(long long)num);
+
+    if (log_operations && bytes >= log_operations_threshold) {
+        SELF_BEGIN(tlog);
+        COUNT_FOLD();
+        fprintf(stderr, PPREFIX "bulk_free(%'lld blocks) -> %'lld"
+                "   (current %'lld)\n", (long long)num, (long long)bytes,
+                curr);
+        SELF_END(SELF_LOG, tlog);
+    }
+}
+
+/* run before other constructors, whose allocations would otherwise be served
+ * by the init heap */
+static __attribute__((constructor(101))) void init(void)
 {
     char *error;
 
     setlocale(LC_NUMERIC, ""); /* for better readable numbers */
 
+#if MALLOC_COUNT_PERCPU
+    percpu_init();
+#endif
+#if MALLOC_COUNT_CHURN
+    churn_start = timestamp_ns();
+#endif
+#if MALLOC_COUNT_PHASES
+    phase_loaded();
+#endif
+
     dlerror();
 
     real_malloc = (malloc_type)dlsym(RTLD_NEXT, "malloc");
@@ -349,13 +3909,67 @@ static __attribute__((constructor)) void init(void)
         fprintf(stderr,  PPREFIX "error %s\n", error);
         exit(EXIT_FAILURE);
     }
+
+#if MALLOC_COUNT_STREAM
+    stream_open();
+#endif
+#if MALLOC_COUNT_TRACE
+    trace_open();
+#endif
+#if MALLOC_COUNT_SITES
+    {   /* load the unwinder now, its own allocations have no site */
+        void* frame;
+        site_busy = 1;
+        backtrace(&frame, 1);
+        site_busy = 0;
+    }
+#endif
+
+#if MALLOC_COUNT_SELF_PROFILE
+    {   /* calibrate the cost of reading the clock */
+        long long ts = timestamp_ns();
+        int i;
+        for (i = 0; i < 1000; ++i) timestamp_ns();
+        self_clock_ns = (timestamp_ns() - ts) / 1001;
+    }
+#endif
 }
 
 static __attribute__((destructor)) void finish(void)
 {
+    COUNT_FOLD();
     fprintf(stderr, PPREFIX
             "exiting, total: %'lld, peak: %'lld, current: %'lld\n",
             total, peak, curr);
+
+#if MALLOC_COUNT_STREAM
+    stream_close();
+#endif
+#if MALLOC_COUNT_TRACE
+    trace_close();
+#endif
+#if MALLOC_COUNT_OMPT
+    ompt_print_regions();
+#endif
+#if MALLOC_COUNT_UNTOUCHED
+    malloc_count_print_untouched();
+#endif
+#if MALLOC_COUNT_CHURN
+    malloc_count_print_churn();
+#endif
+#if MALLOC_COUNT_PAIRS
+    malloc_count_print_pairs();
+#endif
+#if MALLOC_COUNT_PHASES
+    malloc_count_print_phases();
+#endif
+#if MALLOC_COUNT_GROW
+    malloc_count_print_grow();
+#endif
+    if (pools_num) malloc_count_print_pools();
+#if MALLOC_COUNT_SELF_PROFILE
+    self_print();
+#endif
 }
 
 /*****************************************************************************/
@@ -38,7 +38,8 @@ extern "C" { /* for inclusion from C++ */
 /* returns the currently allocated amount of memory */
 extern size_t malloc_count_current(void);
 
-/* returns the current peak memory allocation */
+/* returns the current peak memory allocation. With MALLOC_COUNT_PERCPU, it may
+ * be under-reported by less than MALLOC_COUNT_PERCPU_BATCH bytes per thread */
 extern size_t malloc_count_peak(void);
 
 /* resets the peak memory allocation to current */
@@ -52,13 +53,145 @@ typedef void (*malloc_count_callback_type)(void* cookie, size_t current);
 
 /* supply malloc_count with a callback function that is invoked on each change
  * of the current allocation. The callback function must not use
- * malloc()/realloc()/free() or it will go into an endless recursive loop! */
+ * malloc()/realloc()/free() or it will go into an endless recursive loop!
+ * With MALLOC_COUNT_PERCPU, current is the sum of the per-CPU slots, which
+ * may miss the updates other threads are making at the same moment. */
 extern void malloc_count_set_callback(malloc_count_callback_type cb,
                                       void* cookie);
 
 /* user function which prints current and peak allocation to stderr */
 extern void malloc_count_print_status(void);
 
+/* set the tag (16 bits) stored in the prefix of all further allocations of the
+ * calling thread, and return the previous one. Tags are 0 by default. */
+extern unsigned int malloc_count_set_tag(unsigned int tag);
+
+/* return the tag of a block allocated via malloc_count */
+extern unsigned int malloc_count_get_tag(const void* ptr);
+
+/* return the sequential number (16 bits, starting at 1) of the thread which
+ * allocated a block, or 0 for blocks allocated before initialization */
+extern unsigned int malloc_count_get_thread(const void* ptr);
+
+/* allocate n blocks of size bytes into out[] by calling the allocator in a
+ * loop, but update the counters and call the callback once for the batch.
+ * Returns the number of blocks allocated, less than n if it failed. */
+extern size_t malloc_count_bulk_alloc(size_t n, size_t size, void** out);
+
+/* free the n blocks of ptrs[], skipping NULL, and update the counters and
+ * call the callback once for the batch */
+extern void malloc_count_bulk_free(void** ptrs, size_t n);
+
+/* statistics of malloc_count, including its own overhead. The self_* fields
+ * except self_internal_bytes are only filled when malloc_count.c is compiled
+ * with MALLOC_COUNT_SELF_PROFILE. */
+struct malloc_count_stats
+{
+    size_t current;             /* currently allocated bytes */
+    size_t peak;                /* peak allocated bytes */
+    size_t total;               /* total allocated bytes */
+    size_t num_allocs;          /* total number of allocations */
+
+    size_t self_blocks;         /* number of blocks with a prefix */
+    size_t self_prefix_bytes;   /* bytes of prefixes of current blocks */
+    size_t self_prefix_peak;    /* peak bytes of prefixes */
+    size_t self_internal_bytes; /* static tables and internal buffers */
+
+    double self_time_count;     /* seconds spent updating the counters */
+    double self_time_callback;  /* seconds spent in the user callback */
+    double self_time_log;       /* seconds spent in log output */
+    double self_time_features;  /* seconds spent in optional features */
+    double self_time_clock;     /* estimated part of the above spent reading
+                                 * the clock for these measurements */
+};
+
+/* fill in the current statistics */
+extern void malloc_count_get_stats(struct malloc_count_stats* stats);
+
+/* write a map of the heap's occupancy by live blocks to path, as matrix of
+ * rows of row_pages pages of page_size bytes (0 for defaults 64 and 4096).
+ * Requires malloc_count.c to be compiled with MALLOC_COUNT_LIVE, returns 0 on
+ * success and -1 on error. See tools/heapmap.gnuplot for plotting. */
+extern int malloc_count_write_heapmap(const char* path, size_t page_size,
+                                      size_t row_pages);
+
+/* print the pairs of call sites whose live blocks, allocated by different
+ * threads, share a cache line and are thus at risk of false sharing. Requires
+ * MALLOC_COUNT_LIVE, and MALLOC_COUNT_SITES to name the sites. */
+extern void malloc_count_print_false_sharing(void);
+
+/* print per call site the fraction of pages of large blocks which were never
+ * touched, of freed blocks and of the live ones. Requires
+ * MALLOC_COUNT_UNTOUCHED, which also prints this report at exit. */
+extern void malloc_count_print_untouched(void);
+
+/* hash the content of every sample-th live block (0 or 1 for all) and print
+ * the largest groups of identical blocks, and per call site the bytes in
+ * duplicate and in mostly zero blocks. Requires MALLOC_COUNT_SITES. Blocks
+ * with non-resident pages are skipped. Allocations of other threads wait
+ * while a single block is hashed or compared. */
+extern void malloc_count_print_duplicates(size_t sample);
+
+/* print the call sites and tags which spent the most time in the allocator,
+ * with allocations per second and the churn ratio of total bytes allocated to
+ * peak live bytes. Requires MALLOC_COUNT_CHURN, which also prints this report
+ * at exit. */
+extern void malloc_count_print_churn(void);
+
+/* print the pairs of allocating and freeing call sites of a sample of the
+ * freed blocks, with estimated counts and bytes, and the share freed by
+ * another thread than the allocating one. Requires MALLOC_COUNT_PAIRS, which
+ * also prints this report at exit. */
+extern void malloc_count_print_pairs(void);
+
+/* mark the end of the program's startup. Requires MALLOC_COUNT_PHASES, which
+ * reports the allocations before main(), between main() and this mark, and
+ * after it separately at exit. */
+extern void malloc_count_mark_ready(void);
+
+/* mark the start of the program's shutdown, which otherwise begins with the
+ * return of main() or malloc_count's exit handler. Requires
+ * MALLOC_COUNT_PHASES, which reports the frees until exit as teardown cost,
+ * and which exports a wrapper of __libc_start_main() for the whole program. */
+extern void malloc_count_mark_shutdown(void);
+
+/* print per phase of the program (before main(), startup until
+ * malloc_count_mark_ready(), run and shutdown) the allocations, bytes, frees,
+ * wall and allocator time, and the sites with the most allocations, or for
+ * the shutdown the sites whose blocks took the most time to free. Requires
+ * MALLOC_COUNT_PHASES, which also prints this report at exit. */
+extern void malloc_count_print_phases(void);
+
+/* print how many reallocs of growing blocks were served from the slack of
+ * geometric over-allocation, i.e. how many copies were avoided. Requires
+ * MALLOC_COUNT_GROW, which also prints this report at exit. */
+extern void malloc_count_print_grow(void);
+
+/* custom pools and arenas, which carve memory out of large blocks, report
+ * their logical allocations like valgrind's mempool client requests. They are
+ * added to the total bytes and number of allocations (but not to the current
+ * and peak, which contain the backing blocks), to allocation events and to
+ * the churn of call sites. malloc_count_pool_create() returns the pool's
+ * number, or -1 if the table is full, which the other functions ignore. */
+extern int malloc_count_pool_create(const char* name);
+
+/* report bytes of backing memory taken (bytes > 0) or returned (bytes < 0)
+ * by a pool. The reserved bytes not handed out are its fragmentation. */
+extern void malloc_count_pool_reserve(int pool, long long bytes);
+
+/* report a logical allocation of size bytes at ptr carved out of a pool */
+extern void malloc_count_pool_alloc(int pool, const void* ptr, size_t size);
+
+/* report that a logical allocation was returned to its pool */
+extern void malloc_count_pool_free(int pool, const void* ptr, size_t size);
+
+/* report that a pool released all its memory */
+extern void malloc_count_pool_destroy(int pool);
+
+/* print per pool the logical allocations, live and reserved bytes, and the
+ * fragmentation. Also printed at exit if any pool was created. */
+extern void malloc_count_print_pools(void);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,126 @@
+/******************************************************************************
+ * malloc_count_event.h
+ *
+ * Layout of allocation events, of the trace file, and of the shared memory
+ * rings in which malloc_count publishes them to an analyzer running in a
+ * separate process.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+#ifndef _MALLOC_COUNT_EVENT_H_
+#define _MALLOC_COUNT_EVENT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" { /* for inclusion from C++ */
+#endif
+
+/* types of allocation events. A realloc() is published as a free of the old
+ * block followed by an allocation of the new one. Logical allocations of
+ * custom pools lie inside blocks and are not part of the heap footprint. */
+#define MALLOC_COUNT_EVENT_ALLOC        1
+#define MALLOC_COUNT_EVENT_FREE         2
+#define MALLOC_COUNT_EVENT_POOL_ALLOC   3
+#define MALLOC_COUNT_EVENT_POOL_FREE    4
+
+/* one allocation event, 32 bytes */
+struct malloc_count_event
+{
+    uint64_t ts;                /* CLOCK_MONOTONIC timestamp in nanoseconds */
+    uint64_t ptr;               /* address of the block as seen by the user */
+    uint64_t size;              /* size of the block, also for frees */
+    uint32_t tid;               /* malloc_count's number of the thread */
+    uint32_t type;              /* MALLOC_COUNT_EVENT_* */
+};
+
+/*****************************************************************************/
+
+#define MALLOC_COUNT_TRACE_MAGIC        0x314543415254434dULL /* "MCTRACE1" */
+
+/* header of a trace file malloc_count-<pid>.trace, followed by the events.
+ * The events of each thread are written in blocks, hence the file is a
+ * sequence of blocks of events sorted by timestamp. */
+struct malloc_count_trace_header
+{
+    uint64_t magic;             /* MALLOC_COUNT_TRACE_MAGIC */
+    uint64_t pid;               /* process which wrote the trace */
+    uint64_t event_bytes;       /* sizeof(struct malloc_count_event) */
+    uint64_t reserved;
+};
+
+/*****************************************************************************/
+
+/* name of the shared memory object is this prefix followed by the pid */
+#define MALLOC_COUNT_STREAM_NAME        "/malloc_count-"
+
+#define MALLOC_COUNT_STREAM_MAGIC       0x31304d525453434dULL /* "MCSTRM01" */
+
+/* header at the beginning of the shared memory object */
+struct malloc_count_stream_header
+{
+    uint64_t magic;             /* MALLOC_COUNT_STREAM_MAGIC */
+    uint64_t pid;               /* process publishing the events */
+    uint64_t num_rings;         /* number of rings following the header */
+    uint64_t capacity;          /* events per ring, a power of two */
+    uint64_t ring_bytes;        /* distance between two rings in bytes */
+
+    /* set to 1 when the process has exited, after its last event */
+    volatile uint64_t finished;
+    /* events dropped because all rings were owned by other threads */
+    volatile uint64_t dropped_norings;
+
+    char pad[8];
+};
+
+/* single-producer single-consumer ring of one thread. The producer only
+ * writes head and dropped, the consumer only writes tail. The events follow
+ * the ring header. */
+struct malloc_count_stream_ring
+{
+    volatile uint64_t head;     /* number of events written */
+    volatile uint64_t dropped;  /* events dropped because the ring was full */
+    volatile uint32_t owner;    /* thread id of the producer, 0 if unowned */
+    char pad0[44];
+
+    volatile uint64_t tail;     /* number of events consumed */
+    char pad1[56];
+};
+
+/* pointer to ring i of the shared memory object starting with header h */
+#define MALLOC_COUNT_STREAM_RING(h, i)                                  \
+    ((struct malloc_count_stream_ring*)                                 \
+     ((char*)(h) + sizeof(struct malloc_count_stream_header)            \
+      + (i) * (h)->ring_bytes))
+
+/* pointer to the event array of ring r */
+#define MALLOC_COUNT_STREAM_EVENTS(r)                                   \
+    ((struct malloc_count_event*)((r) + 1))
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _MALLOC_COUNT_EVENT_H_ */
+
+/*****************************************************************************/
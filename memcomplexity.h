@@ -0,0 +1,266 @@
+/******************************************************************************
+ * memcomplexity.h
+ *
+ * Class to fit the memory usage of a function over a series of input sizes to
+ * complexity classes using malloc_count.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef _MEM_COMPLEXITY_H_
+#define _MEM_COMPLEXITY_H_
+
+#include <stdio.h>
+#include <math.h>
+
+#include <vector>
+
+#include "malloc_count.h"
+
+/**
+ * MemComplexity runs a function at a series of input sizes n and records the
+ * heap peak, the total bytes allocated and the number of allocations of each
+ * run. Each of these metrics is fitted by least squares to a + b * g(n) for
+ * the models g(n) = 1, log n, n, n log n and n^2.
+ *
+ * The model with the smallest root mean square error is taken, however, a
+ * simpler model is preferred if its error is within a tolerance of the best,
+ * since every more complex model fits constant data just as well. Errors are
+ * relative to the mean of the measured values.
+ *
+ * check() compares the fitted class with the expected one and thus catches
+ * scaling regressions, like structures which accidentally grow quadratically,
+ * using small inputs. The sizes should span at least two orders of magnitude.
+ */
+class MemComplexity
+{
+public:
+
+    /// complexity classes, in ascending order
+    enum Complexity { O1, OlogN, ON, ONlogN, ON2, NUM_COMPLEXITIES };
+
+    /// measured metrics of each run
+    enum Metric { PEAK, TOTAL, ALLOCS, NUM_METRICS };
+
+    /// result of fitting a metric: value(n) = constant + coefficient * g(n)
+    struct Fit
+    {
+        Complexity  complexity;
+        double      constant;
+        double      coefficient;
+        /// root mean square error relative to the mean value
+        double      rms;
+    };
+
+protected:
+
+    /// name of the measured function in the output
+    const char* m_name;
+
+    /// tolerance of the relative error to prefer simpler models
+    double      m_tolerance;
+
+    /// input sizes of the runs
+    std::vector<double> m_sizes;
+
+    /// measured metrics of the runs
+    std::vector<double> m_values[NUM_METRICS];
+
+protected:
+
+    /// value of model c at size n
+    static double model(Complexity c, double n)
+    {
+        switch (c) {
+        case O1:     return 1;
+        case OlogN:  return log(n);
+        case ON:     return n;
+        case ONlogN: return n * log(n);
+        case ON2:    return n * n;
+        default:     return 0;
+        }
+    }
+
+    /// fit metric m to a single model by least squares
+    Fit fit(Metric m, Complexity c) const
+    {
+        const std::vector<double>& y = m_values[m];
+        size_t k = y.size();
+        double mx = 0, my = 0, sxx = 0, sxy = 0;
+
+        Fit f;
+        f.complexity = c;
+        f.constant = f.coefficient = f.rms = 0;
+        if (k == 0) return f;
+
+        for (size_t i = 0; i < k; ++i) {
+            mx += model(c, m_sizes[i]);
+            my += y[i];
+        }
+        mx /= k, my /= k;
+
+        for (size_t i = 0; i < k; ++i) {
+            double dx = model(c, m_sizes[i]) - mx;
+            sxx += dx * dx;
+            sxy += dx * (y[i] - my);
+        }
+
+        if (c != O1 && sxx > 0)
+            f.coefficient = sxy / sxx;
+        f.constant = my - f.coefficient * mx;
+
+        double sse = 0;
+        for (size_t i = 0; i < k; ++i) {
+            double r = y[i] - f.constant - f.coefficient * model(c, m_sizes[i]);
+            sse += r * r;
+        }
+        f.rms = sqrt(sse / k) / (fabs(my) > 1 ? fabs(my) : 1);
+
+        // a shrinking model does not describe memory growth
+        if (f.coefficient < 0) f.rms = HUGE_VAL;
+
+        return f;
+    }
+
+public:
+
+    /** Constructor for MemComplexity.
+     * @param name      name of the measured function in the output.
+     * @param tolerance relative error by which a simpler model may fit worse
+     *                  than the best one and still be chosen.
+     */
+    MemComplexity(const char* name, double tolerance = 0.05)
+        : m_name(name), m_tolerance(tolerance)
+    { }
+
+    /// Run function(n) once and record its metrics. Memory still held after
+    /// the function returned counts towards the peak.
+    template <typename Function>
+    void run(Function function, size_t n)
+    {
+        struct malloc_count_stats before, after;
+
+        // allocate the result slots first, so they are not measured
+        m_sizes.reserve(m_sizes.size() + 1);
+        for (int m = 0; m < NUM_METRICS; ++m)
+            m_values[m].reserve(m_values[m].size() + 1);
+
+        malloc_count_reset_peak();
+        malloc_count_get_stats(&before);
+
+        function(n);
+
+        malloc_count_get_stats(&after);
+
+        m_sizes.push_back(n);
+        m_values[PEAK].push_back((double)(after.peak - before.current));
+        m_values[TOTAL].push_back((double)(after.total - before.total));
+        m_values[ALLOCS].push_back(
+            (double)(after.num_allocs - before.num_allocs));
+    }
+
+    /// Run function(n) for all sizes.
+    template <typename Function>
+    void run(Function function, const std::vector<size_t>& sizes)
+    {
+        for (size_t i = 0; i < sizes.size(); ++i)
+            run(function, sizes[i]);
+    }
+
+    /// Sizes from first up to last, each factor times the previous.
+    static std::vector<size_t> geometric(size_t first, size_t last,
+                                         double factor = 2)
+    {
+        std::vector<size_t> sizes;
+        for (double n = first; n <= last; n *= factor)
+            sizes.push_back((size_t)n);
+        return sizes;
+    }
+
+    /// Fit a metric to all models and choose one.
+    Fit fit(Metric m) const
+    {
+        Fit fits[NUM_COMPLEXITIES];
+        int best = 0;
+
+        for (int c = 0; c < NUM_COMPLEXITIES; ++c) {
+            fits[c] = fit(m, (Complexity)c);
+            if (fits[c].rms < fits[best].rms) best = c;
+        }
+
+        for (int c = 0; c < best; ++c) {
+            if (fits[c].rms <= fits[best].rms + m_tolerance)
+                return fits[c];
+        }
+        return fits[best];
+    }
+
+    /// Check that metric m grows at most with complexity max. Prints a
+    /// message and returns false otherwise.
+    bool check(Metric m, Complexity max) const
+    {
+        Fit f = fit(m);
+        if (f.complexity <= max) return true;
+
+        fprintf(stderr, "memcomplexity: %s %s grows with %s, expected %s\n",
+                m_name, name(m), name(f.complexity), name(max));
+        return false;
+    }
+
+    /// Print the measurements and the fitted model of each metric.
+    void print(FILE* out = stdout) const
+    {
+        fprintf(out, "%s:\n%12s %14s %14s %12s\n",
+                m_name, "n", "peak", "total", "allocs");
+        for (size_t i = 0; i < m_sizes.size(); ++i) {
+            fprintf(out, "%12.0f %14.0f %14.0f %12.0f\n", m_sizes[i],
+                    m_values[PEAK][i], m_values[TOTAL][i],
+                    m_values[ALLOCS][i]);
+        }
+        for (int m = 0; m < NUM_METRICS; ++m) {
+            Fit f = fit((Metric)m);
+            fprintf(out, "  %-7s %-10s = %g + %g * %s, rms %.3f\n",
+                    name((Metric)m), name(f.complexity), f.constant,
+                    f.coefficient, model_name(f.complexity), f.rms);
+        }
+    }
+
+    static const char* name(Complexity c)
+    {
+        static const char* names[NUM_COMPLEXITIES] =
+            { "O(1)", "O(log n)", "O(n)", "O(n log n)", "O(n^2)" };
+        return names[c];
+    }
+
+    static const char* model_name(Complexity c)
+    {
+        static const char* names[NUM_COMPLEXITIES] =
+            { "1", "log(n)", "n", "n*log(n)", "n^2" };
+        return names[c];
+    }
+
+    static const char* name(Metric m)
+    {
+        static const char* names[NUM_METRICS] =
+            { "peak", "total", "allocs" };
+        return names[m];
+    }
+};
+
+#endif // _MEM_COMPLEXITY_H_
+
+/*****************************************************************************/
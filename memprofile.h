@@ -26,6 +26,10 @@
 #include <stdio.h>
 #include <sys/time.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "malloc_count.h"
 
 /**
@@ -66,6 +70,13 @@ protected:
     /// maximum memory usage to previous log output
     size_t      m_max;
 
+    /// optional sampler of the stack depth, written as an additional column
+    size_t      (*m_stack_sampler)(int reset);
+
+    /// flag to ignore heap changes caused by writing the log (the first
+    /// output allocates the FILE's buffer, which would recurse endlessly)
+    bool        m_in_callback;
+
 protected:
 
     /// template function missing in cmath, absolute difference
@@ -90,7 +101,18 @@ protected:
     /// output a data pair (ts,mem) to log file
     inline void output(double ts, unsigned long long mem)
     {
-        if (m_funcname) { // more verbose output format
+        if (m_stack_sampler) { // with sampled stack depth channel
+            unsigned long long stack = m_stack_sampler(1);
+            if (m_funcname) {
+                fprintf(m_file, "func=%s ts=%g mem=%llu stack=%llu\n",
+                        m_funcname, ts - m_base_ts, mem, stack);
+            }
+            else {
+                fprintf(m_file, "%g %llu %llu\n",
+                        ts - m_base_ts, mem, stack);
+            }
+        }
+        else if (m_funcname) { // more verbose output format
             fprintf(m_file, "func=%s ts=%g mem=%llu\n",
                     m_funcname, ts - m_base_ts, mem);
         }
@@ -103,6 +125,9 @@ protected:
     /// callback invoked by malloc_count when heap usage changes.
     inline void callback(size_t memcurr)
     {
+        if (m_in_callback) return;
+        m_in_callback = true;
+
         size_t mem = (memcurr > m_base_mem) ? (memcurr - m_base_mem) : 0;
 
         if ((char*)&mem < m_stack_base) // add stack usage
@@ -120,6 +145,8 @@ protected:
             m_prev_ts = ts;
             m_prev_mem = mem;
         }
+
+        m_in_callback = false;
     }
 
     /// static callback for malloc_count, forwards to class method.
@@ -146,7 +173,9 @@ public:
           m_base_mem( malloc_count_current() ),
           m_prev_ts( 0 ),
           m_prev_mem( 0 ),
-          m_max( 0 )
+          m_max( 0 ),
+          m_stack_sampler( NULL ),
+          m_in_callback( false )
     {
         char stack;
         m_stack_base = &stack;
@@ -154,6 +183,14 @@ public:
         malloc_count_set_callback(MemProfile::static_callback, this);
     }
 
+    /// Write the peak stack depth sampled since the previous output as an
+    /// additional column, e.g. using stack_count_sample_peak() of stack_count
+    /// with stack_count_sample_start() called in each thread of interest.
+    void set_stack_sampler(size_t (*sampler)(int reset))
+    {
+        m_stack_sampler = sampler;
+    }
+
     /// Destructor flushes currently aggregated values and closes the file.
     ~MemProfile()
     {
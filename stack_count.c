@@ -25,23 +25,120 @@
  * IN THE SOFTWARE.
  *****************************************************************************/
 
+#define _GNU_SOURCE
 #include "stack_count.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 
 /* default stack size on Linux is 8 MiB, so fill 75% of it. */
 static const size_t stacksize = 6*1024*1024;
 
+/* maximum number of open nested measurements of a thread */
+#define STACK_COUNT_NESTING 64
+
+/* open measurement: the deepest address used since it began */
+struct stack_count_record
+{
+    char*   base;
+    char*   deepest;
+    int     active;
+};
+
+/* lowest painted address of the thread's stack, and its open measurements */
+static __thread uint32_t* painted_low = NULL;
+static __thread struct stack_count_record records[STACK_COUNT_NESTING];
+static __thread int records_num = 0;
+
+/* find the deepest overwritten word of the painted stack and account it to all
+ * open measurements, before it is painted again. Returns NULL if nothing was
+ * painted yet. */
+static char* stack_count_checkpoint(void)
+{
+    uint32_t* p = painted_low;
+    int i;
+
+    if (!p) return NULL;
+    while ( *p == 0xDEADC0DEu ) ++p;
+
+    for (i = 0; i < records_num; ++i) {
+        if (records[i].active && (char*)p < records[i].deepest)
+            records[i].deepest = (char*)p;
+    }
+    return (char*)p;
+}
+
+/* paint bytes of the stack below the caller's frame */
+static __attribute__((noinline)) void stack_count_repaint(size_t bytes)
+{
+    const size_t asize = bytes / sizeof(uint32_t);
+    uint32_t stack[asize]; /* allocated on stack */
+    volatile uint32_t* p = stack;
+    while ( p < stack + asize ) *p++ = 0xDEADC0DEu;
+    if (!painted_low || stack < painted_low) painted_low = stack;
+}
+
 /* "clear" the stack by writing a sentinel value into it. */
 void* stack_count_clear(void)
 {
     const size_t asize = stacksize / sizeof(uint32_t);
     uint32_t stack[asize]; /* allocated on stack */
     uint32_t* p = stack;
+    stack_count_checkpoint();
     while ( p < stack + asize ) *p++ = 0xDEADC0DEu;
+    if (!painted_low || stack < painted_low) painted_low = stack;
     return p;
 }
 
+/* begin a nested measurement of the stack below the caller. Enclosing
+ * measurements survive, since only the part below the current frame which was
+ * used since the last paint is painted again. Returns an id for
+ * stack_count_end(), or -1 if too many measurements are open. */
+int stack_count_begin(void)
+{
+    volatile char here;
+    char* deepest = stack_count_checkpoint();
+    int id;
+
+    if (!deepest)
+        stack_count_repaint(stacksize);
+    else if (deepest < (char*)&here)
+        stack_count_repaint((char*)&here - deepest + 1024);
+
+    if (records_num == STACK_COUNT_NESTING) return -1;
+
+    id = records_num++;
+    records[id].base = (char*)&here;
+    records[id].deepest = (char*)&here;
+    records[id].active = 1;
+    return id;
+}
+
+/* end the measurement with the given id, which need not be the innermost one,
+ * and return its maximum stack usage below the frame of its begin. */
+size_t stack_count_end(int id)
+{
+    size_t used;
+
+    if (id < 0 || id >= records_num || !records[id].active) return 0;
+
+    stack_count_checkpoint();
+    used = records[id].base - records[id].deepest;
+    records[id].active = 0;
+
+    while (records_num > 0 && !records[records_num - 1].active)
+        --records_num;
+
+    return used;
+}
+
 /* checks the maximum usage of the stack since the last clear call. */
 size_t stack_count_usage(void* lastbase)
 {
@@ -51,4 +148,436 @@ size_t stack_count_usage(void* lastbase)
     return ((uint32_t*)lastbase - p) * sizeof(uint32_t);
 }
 
+/* words of the stack below the caller of stack_count_paint() which are left
+ * untouched when painting the region the caller runs on. */
+static const size_t paint_gap = 256;
+
+/* "clear" the region [base, base+size) by writing a sentinel value into it. If
+ * the calling thread runs on this region, only the part below the current
+ * frame is painted. */
+void stack_count_paint(void* base, size_t size)
+{
+    volatile char here;
+    uint32_t* p = (uint32_t*)(((uintptr_t)base + 3) & ~(uintptr_t)3);
+    uint32_t* end = (uint32_t*)(((uintptr_t)base + size) & ~(uintptr_t)3);
+
+    if ((char*)&here > (char*)base && (char*)&here < (char*)base + size) {
+        end = (uint32_t*)(((uintptr_t)&here - paint_gap * sizeof(uint32_t))
+                          & ~(uintptr_t)3);
+    }
+    while ( p < end ) *p++ = 0xDEADC0DEu;
+}
+
+/* checks the maximum usage of the painted region [base, base+size) of a
+ * downwards growing stack. */
+size_t stack_count_measure(const void* base, size_t size)
+{
+    const uint32_t* p =
+        (const uint32_t*)(((uintptr_t)base + 3) & ~(uintptr_t)3);
+    const uint32_t* end =
+        (const uint32_t*)(((uintptr_t)base + size) & ~(uintptr_t)3);
+
+    while ( p < end && *p == 0xDEADC0DEu ) ++p;
+    return (const char*)base + size - (const char*)p;
+}
+
+/* registered stack region, unused slots have base NULL and are linked by
+ * next_free */
+struct stack_count_region
+{
+    void*   base;
+    size_t  size;
+    int     next_free;
+};
+
+static struct stack_count_region* regions = NULL;
+static int regions_num = 0, regions_capacity = 0;
+static int regions_free = -1;
+static volatile int regions_lock = 0;
+
+static void regions_acquire(void)
+{
+    while (__sync_lock_test_and_set(&regions_lock, 1)) {
+        while (regions_lock) { }
+    }
+}
+
+static void regions_release(void)
+{
+    __sync_lock_release(&regions_lock);
+}
+
+/* paint the region [base, base+size) and register it for
+ * stack_count_measure_all(). Returns its id or -1 if out of memory. */
+int stack_count_register(void* base, size_t size)
+{
+    int id;
+
+    stack_count_paint(base, size);
+
+    regions_acquire();
+
+    if (regions_free >= 0) {
+        id = regions_free;
+        regions_free = regions[id].next_free;
+    }
+    else {
+        if (regions_num == regions_capacity)
+        {
+            int capacity = regions_capacity ? 2 * regions_capacity : 64;
+            struct stack_count_region* r = (struct stack_count_region*)
+                realloc(regions, capacity * sizeof(*r));
+            if (!r) {
+                regions_release();
+                return -1;
+            }
+            regions = r;
+            regions_capacity = capacity;
+        }
+        id = regions_num++;
+    }
+
+    regions[id].base = base;
+    regions[id].size = size;
+
+    regions_release();
+    return id;
+}
+
+/* remove the region with the given id from the registered ones. */
+void stack_count_unregister(int id)
+{
+    regions_acquire();
+    if (id >= 0 && id < regions_num && regions[id].base) {
+        regions[id].base = NULL;
+        regions[id].next_free = regions_free;
+        regions_free = id;
+    }
+    regions_release();
+}
+
+/* measure all registered regions, calls cb for each if it is not NULL, and
+ * returns the maximum usage. */
+size_t stack_count_measure_all(stack_count_region_callback cb, void* cookie)
+{
+    size_t used, max = 0;
+    int i;
+
+    regions_acquire();
+    for (i = 0; i < regions_num; ++i)
+    {
+        if (!regions[i].base) continue;
+        used = stack_count_measure(regions[i].base, regions[i].size);
+        if (used > max) max = used;
+        if (cb) cb(cookie, i, regions[i].base, regions[i].size, used);
+    }
+    regions_release();
+
+    return max;
+}
+
+/* allocate, paint, register and install an alternate signal stack of size
+ * bytes for the calling thread. Returns its base or NULL on errors, and its
+ * region id and the previous alternate stack in *id and *old. */
+void* stack_count_sigaltstack(size_t size, int* id, stack_t* old)
+{
+    stack_t ss;
+    void* base = malloc(size);
+    int myid;
+
+    if (!base) return NULL;
+
+    ss.ss_sp = base;
+    ss.ss_size = size;
+    ss.ss_flags = 0;
+
+    if ((myid = stack_count_register(base, size)) < 0) {
+        free(base);
+        return NULL;
+    }
+    if (sigaltstack(&ss, old) != 0) {
+        stack_count_unregister(myid);
+        free(base);
+        return NULL;
+    }
+    if (id) *id = myid;
+    return base;
+}
+
+/* switch back to the previous alternate signal stack, then unregister and
+ * free the one installed by stack_count_sigaltstack(). */
+int stack_count_sigaltstack_free(void* base, int id, const stack_t* old)
+{
+    stack_t none;
+
+    if (!old) {
+        memset(&none, 0, sizeof(none));
+        none.ss_flags = SS_DISABLE;
+        old = &none;
+    }
+    if (sigaltstack(old, NULL) != 0) return -1;
+
+    stack_count_unregister(id);
+    free(base);
+    return 0;
+}
+
+/* maximum number of threads whose stack depth is sampled */
+#define STACK_COUNT_SAMPLE_THREADS 256
+
+/* number of most recent samples kept per thread */
+#define STACK_COUNT_SAMPLES 4096
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+struct stack_count_sample
+{
+    double  ts;
+    size_t  depth;
+};
+
+/* sampled thread. Only the thread's signal handler writes the samples. */
+struct stack_count_sampled
+{
+    volatile int    used;
+    int             running;
+    volatile int    exited;     /* owning thread has exited */
+    timer_t         timer;
+    char*           top;        /* highest address of the thread's stack */
+    size_t          hwm;        /* maximum depth sampled */
+    volatile size_t count;      /* number of samples taken */
+    struct stack_count_sample* samples;
+};
+
+static struct stack_count_sampled sampled[STACK_COUNT_SAMPLE_THREADS];
+static __thread struct stack_count_sampled* sampled_self = NULL;
+
+/* maximum depth over all threads since the last reset */
+static volatile size_t sample_peak = 0;
+
+/* key whose destructor stops the timer of an exiting sampled thread */
+static pthread_key_t sample_key;
+static pthread_once_t sample_key_once = PTHREAD_ONCE_INIT;
+
+/* thread exit: delete the timer, it would target a dead thread id. The
+ * samples remain available until stack_count_sample_release(). */
+static void stack_count_sample_exit(void* p)
+{
+    struct stack_count_sampled* t = (struct stack_count_sampled*)p;
+
+    if (t->running) {
+        timer_delete(t->timer);
+        t->running = 0;
+    }
+    sampled_self = NULL;
+    t->exited = 1;
+}
+
+static void stack_count_sample_key_create(void)
+{
+    pthread_key_create(&sample_key, stack_count_sample_exit);
+}
+
+/* free the samples of a stopped slot and return it for reuse */
+static void stack_count_sample_free(struct stack_count_sampled* t)
+{
+    struct stack_count_sample* samples = t->samples;
+
+    t->samples = NULL;
+    free(samples);
+    t->top = NULL;
+    t->hwm = 0;
+    t->count = 0;
+    t->running = 0;
+    t->exited = 0;
+    __sync_lock_release(&t->used);
+}
+
+/* SIGPROF handler: take the stack pointer of the interrupted context */
+static void stack_count_sample_handler(int sig, siginfo_t* si, void* context)
+{
+    struct stack_count_sampled* t = sampled_self;
+    ucontext_t* uc = (ucontext_t*)context;
+    struct timespec ts;
+    char* sp;
+    size_t depth, peak;
+    int saved_errno = errno;
+    (void)sig; (void)si; (void)uc;
+
+    if (!t) return;
+
+#if defined(__x86_64__)
+    sp = (char*)uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__i386__)
+    sp = (char*)uc->uc_mcontext.gregs[REG_ESP];
+#elif defined(__aarch64__)
+    sp = (char*)uc->uc_mcontext.sp;
+#else
+    sp = (char*)&t; /* handler's frame, deeper by the signal frame */
+#endif
+
+    depth = (sp < t->top) ? (size_t)(t->top - sp) : 0;
+    if (depth > t->hwm) t->hwm = depth;
+    while ((peak = sample_peak) < depth &&
+           !__sync_bool_compare_and_swap(&sample_peak, peak, depth)) { }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t->samples[t->count % STACK_COUNT_SAMPLES].ts =
+        ts.tv_sec + ts.tv_nsec / 1e9;
+    t->samples[t->count % STACK_COUNT_SAMPLES].depth = depth;
+    t->count++;
+
+    errno = saved_errno;
+}
+
+/* start sampling the stack depth of the calling thread with a SIGPROF timer
+ * every interval seconds of its CPU time. Returns 0, or -1 on errors. */
+int stack_count_sample_start(double interval)
+{
+    static volatile int handler_installed = 0;
+    struct stack_count_sampled* t = sampled_self;
+    struct sigaction sa;
+    struct sigevent sev;
+    struct itimerspec its;
+    pthread_attr_t attr;
+    void* stackaddr;
+    size_t stacksz;
+    int i;
+
+    if (t && t->running) return 0;
+
+    if (!t) {
+        for (i = 0; i < STACK_COUNT_SAMPLE_THREADS; ++i) {
+            if (!sampled[i].used &&
+                __sync_bool_compare_and_swap(&sampled[i].used, 0, 1)) {
+                t = &sampled[i];
+                break;
+            }
+        }
+        if (!t) return -1;
+
+        t->samples = (struct stack_count_sample*)
+            malloc(STACK_COUNT_SAMPLES * sizeof(struct stack_count_sample));
+        if (!t->samples) {
+            stack_count_sample_free(t);
+            return -1;
+        }
+
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            stack_count_sample_free(t);
+            return -1;
+        }
+        pthread_attr_getstack(&attr, &stackaddr, &stacksz);
+        pthread_attr_destroy(&attr);
+        t->top = (char*)stackaddr + stacksz;
+
+        pthread_once(&sample_key_once, stack_count_sample_key_create);
+        if (pthread_setspecific(sample_key, t) != 0) {
+            stack_count_sample_free(t);
+            return -1;
+        }
+        sampled_self = t;
+    }
+
+    if (!handler_installed &&
+        __sync_bool_compare_and_swap(&handler_installed, 0, 1))
+    {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = stack_count_sample_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGPROF, &sa, NULL);
+    }
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &t->timer) != 0) {
+        if (!t->count) stack_count_sample_release();
+        return -1;
+    }
+
+    its.it_value.tv_sec = (time_t)interval;
+    its.it_value.tv_nsec = (long)((interval - (time_t)interval) * 1e9);
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+        its.it_value.tv_nsec = 1;
+    its.it_interval = its.it_value;
+
+    t->running = 1;
+
+    if (timer_settime(t->timer, 0, &its, NULL) != 0) {
+        timer_delete(t->timer);
+        t->running = 0;
+        if (!t->count) stack_count_sample_release();
+        return -1;
+    }
+    return 0;
+}
+
+/* stop sampling the calling thread. Its samples remain available. */
+void stack_count_sample_stop(void)
+{
+    struct stack_count_sampled* t = sampled_self;
+
+    if (!t || !t->running) return;
+    timer_delete(t->timer);
+    t->running = 0;
+}
+
+/* stop sampling the calling thread and release its slot and samples, and
+ * those of all sampled threads that have exited. */
+void stack_count_sample_release(void)
+{
+    struct stack_count_sampled* t = sampled_self;
+    int i;
+
+    if (t) {
+        stack_count_sample_stop();
+        pthread_setspecific(sample_key, NULL);
+        sampled_self = NULL;
+        stack_count_sample_free(t);
+    }
+    for (i = 0; i < STACK_COUNT_SAMPLE_THREADS; ++i) {
+        if (sampled[i].used && sampled[i].exited)
+            stack_count_sample_free(&sampled[i]);
+    }
+}
+
+/* return the maximum sampled depth of all threads, and reset it if reset is
+ * not zero. */
+size_t stack_count_sample_peak(int reset)
+{
+    return reset ? __sync_lock_test_and_set(&sample_peak, 0) : sample_peak;
+}
+
+/* invoke cb for the kept samples of all sampled threads, one thread after
+ * another in time order, and return the maximum high-water mark. */
+size_t stack_count_sample_timeline(stack_count_sample_callback cb,
+                                   void* cookie)
+{
+    size_t max = 0, count, k;
+    int i;
+
+    for (i = 0; i < STACK_COUNT_SAMPLE_THREADS; ++i)
+    {
+        const struct stack_count_sampled* t = &sampled[i];
+        if (!t->used || !t->samples) continue;
+
+        if (t->hwm > max) max = t->hwm;
+        if (!cb) continue;
+
+        count = t->count;
+        k = (count > STACK_COUNT_SAMPLES) ? count - STACK_COUNT_SAMPLES : 0;
+        for ( ; k < count; ++k) {
+            const struct stack_count_sample* s =
+                &t->samples[k % STACK_COUNT_SAMPLES];
+            cb(cookie, i, s->ts, s->depth, t->hwm);
+        }
+    }
+    return max;
+}
+
 /*****************************************************************************/
@@ -29,6 +29,7 @@
 #define _STACK_COUNT_H_
 
 #include <stddef.h>
+#include <signal.h>
 
 #ifdef __cplusplus
 extern "C" { /* for inclusion from C++ */
@@ -40,6 +41,76 @@ extern void* stack_count_clear(void);
 /* checks the maximum usage of the stack since the last clear call. */
 extern size_t stack_count_usage(void* lastbase);
 
+/* begin a nested measurement of the stack usage below the caller. Open
+ * measurements of the thread survive inner begins and clears. Returns an id
+ * for stack_count_end(), or -1 if too many measurements are open. */
+extern int stack_count_begin(void);
+
+/* end a measurement, not necessarily the innermost, and return its maximum
+ * stack usage. */
+extern size_t stack_count_end(int id);
+
+/* "clear" a user-supplied stack region [base, base+size), e.g. of a fiber or
+ * coroutine, by writing the sentinel value into it. If the calling thread
+ * runs on this region, only the part below the current frame is painted. */
+extern void stack_count_paint(void* base, size_t size);
+
+/* checks the maximum usage of a painted, downwards growing stack region. */
+extern size_t stack_count_measure(const void* base, size_t size);
+
+/* paint a stack region and register it for batched measurement. Returns an
+ * id for stack_count_unregister(), or -1 on errors. Thread-safe. */
+extern int stack_count_register(void* base, size_t size);
+
+/* remove a registered stack region, e.g. before the fiber's stack is freed. */
+extern void stack_count_unregister(int id);
+
+/* typedef of callback function for stack_count_measure_all() */
+typedef void (*stack_count_region_callback)(void* cookie, int id, void* base,
+                                            size_t size, size_t used);
+
+/* measure all registered stack regions, invoking cb (if not NULL) for each of
+ * them, and return the maximum usage. cb must not register regions. */
+extern size_t stack_count_measure_all(stack_count_region_callback cb,
+                                      void* cookie);
+
+/* allocate, paint and register an alternate signal stack (sigaltstack) of
+ * size bytes for the calling thread. Returns its base for
+ * stack_count_measure(), or NULL on errors. The region's id and the previous
+ * alternate stack are stored in *id and *old, if these are not NULL. */
+extern void* stack_count_sigaltstack(size_t size, int* id, stack_t* old);
+
+/* restore the previous alternate signal stack old (if not NULL), unregister
+ * the region id and free the stack at base. Returns 0, or -1 if the stack
+ * could not be switched, e.g. while a handler runs on it. */
+extern int stack_count_sigaltstack_free(void* base, int id,
+                                        const stack_t* old);
+
+/* start sampling the stack depth of the calling thread, without painting, by
+ * a per-thread SIGPROF timer every interval seconds of the thread's CPU time.
+ * Returns 0, or -1 on errors. */
+extern int stack_count_sample_start(double interval);
+
+/* stop sampling the calling thread, its samples remain available. */
+extern void stack_count_sample_stop(void);
+
+/* stop sampling the calling thread and free its samples and those of exited
+ * threads, after they have been consumed. Threads stop sampling at exit. */
+extern void stack_count_sample_release(void);
+
+/* maximum sampled stack depth of all threads, reset to zero if reset != 0. */
+extern size_t stack_count_sample_peak(int reset);
+
+/* typedef of callback function for stack_count_sample_timeline() */
+typedef void (*stack_count_sample_callback)(void* cookie, int thread,
+                                            double ts, size_t depth,
+                                            size_t hwm);
+
+/* invoke cb (if not NULL) for the most recent samples of each sampled thread,
+ * with its high-water mark, and return the maximum high-water mark. */
+extern size_t stack_count_sample_timeline(stack_count_sample_callback cb,
+                                          void* cookie);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
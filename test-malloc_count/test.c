@@ -25,12 +25,14 @@
  * IN THE SOFTWARE.
  *****************************************************************************/
 
+#define _GNU_SOURCE
 #include "malloc_count.h"
 #include "stack_count.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <signal.h>
 
 void function_use_stack()
 {
@@ -38,6 +40,12 @@ void function_use_stack()
     memset(data, 1, sizeof(data));
 }
 
+void signal_use_stack(int sig)
+{
+    char data[4*1024];
+    memset(data, sig, sizeof(data));
+}
+
 int main()
 {
     /* allocate and free some memory */
@@ -64,6 +72,48 @@ int main()
     void* c = realloc(NULL, 1*1024*1024);
     c = realloc(c, 0);
 
+    /* query all statistics, including malloc_count's own overhead */
+    {
+        struct malloc_count_stats stats;
+        malloc_count_get_stats(&stats);
+        printf("total allocated: %lld in %lld allocations,"
+               " malloc_count internal: %lld\n",
+               (long long)stats.total, (long long)stats.num_allocs,
+               (long long)stats.self_internal_bytes);
+    }
+
+    /* tag allocations, the tag is kept in the block's prefix */
+    {
+        unsigned int prev = malloc_count_set_tag(42);
+        void* d = malloc(100);
+        malloc_count_set_tag(prev);
+        printf("block tag: %u, allocating thread: %u\n",
+               malloc_count_get_tag(d), malloc_count_get_thread(d));
+        free(d);
+    }
+
+    /* allocate and free a batch of blocks with one counter update each */
+    {
+        void* blocks[64];
+        size_t n = malloc_count_bulk_alloc(64, 1000, blocks);
+        printf("bulk allocated %lld blocks, current %lld\n",
+               (long long)n, (long long)malloc_count_current());
+        malloc_count_bulk_free(blocks, n);
+    }
+
+    /* a custom pool reports the allocations it carves out of its arena */
+    {
+        int pool = malloc_count_pool_create("test pool");
+        char* arena = (char*)malloc(4096);
+        malloc_count_pool_reserve(pool, 4096);
+        malloc_count_pool_alloc(pool, arena, 1000);
+        malloc_count_pool_alloc(pool, arena + 1024, 1000);
+        malloc_count_pool_free(pool, arena, 1000);
+        malloc_count_print_pools();
+        malloc_count_pool_destroy(pool);
+        free(arena);
+    }
+
     /* show how stack_count works */
     {
         void* base = stack_count_clear();
@@ -72,6 +122,37 @@ int main()
                (long long)stack_count_usage(base));
     }
 
+    /* nested measurements: the outer one survives the inner one */
+    {
+        int outer = stack_count_begin(), inner;
+        function_use_stack();
+        inner = stack_count_begin();
+        signal_use_stack(0);
+        printf("nested stack usage: inner %lld, outer %lld\n",
+               (long long)stack_count_end(inner),
+               (long long)stack_count_end(outer));
+    }
+
+    /* measure a user-supplied stack region: an alternate signal stack */
+    {
+        struct sigaction sa;
+        stack_t oldstack;
+        int altid;
+        void* altstack = stack_count_sigaltstack(64*1024, &altid, &oldstack);
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = signal_use_stack;
+        sa.sa_flags = SA_ONSTACK;
+        sigaction(SIGUSR1, &sa, NULL);
+        raise(SIGUSR1);
+
+        printf("signal stack usage: %lld\n",
+               (long long)stack_count_measure(altstack, 64*1024));
+
+        signal(SIGUSR1, SIG_DFL);
+        stack_count_sigaltstack_free(altstack, altid, &oldstack);
+    }
+
     return 0;
 }
 
@@ -0,0 +1,109 @@
+/******************************************************************************
+ * test-memcomplexity/test.cc
+ *
+ * Example to fit the memory complexity of functions, which fails if one grows
+ * faster than expected.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include "memcomplexity.h"
+
+#include <stdlib.h>
+
+#include <vector>
+#include <set>
+
+// allocates a fixed buffer regardless of n
+void constant(size_t)
+{
+    std::vector<char> v(4096);
+}
+
+// keeps one block per halving of n alive, like a recursive bisection
+void bisect(size_t n)
+{
+    std::vector<char> v(64);
+    if (n > 1) bisect(n / 2);
+}
+
+void fill_vector(size_t n)
+{
+    std::vector<int> v;
+    for (size_t i = 0; i < n; ++i)
+        v.push_back(i);
+}
+
+void fill_set(size_t n)
+{
+    std::set<int> v;
+    for (size_t i = 0; i < n; ++i)
+        v.insert(i);
+}
+
+// an accidentally quadratic structure: row i keeps a copy of all rows before
+void triangle(size_t n)
+{
+    std::vector< std::vector<int> > rows(n);
+    for (size_t i = 1; i < n; ++i) {
+        rows[i] = rows[i - 1];
+        rows[i].push_back(i);
+    }
+}
+
+int main()
+{
+    std::vector<size_t> sizes = MemComplexity::geometric(256, 65536);
+    bool ok = true;
+
+    {
+        MemComplexity mc("constant");
+        mc.run(constant, sizes);
+        mc.print();
+        ok &= mc.check(MemComplexity::PEAK, MemComplexity::O1);
+    }
+    {
+        MemComplexity mc("bisect");
+        mc.run(bisect, sizes);
+        mc.print();
+        ok &= mc.check(MemComplexity::PEAK, MemComplexity::OlogN);
+    }
+    {
+        MemComplexity mc("fill_vector");
+        mc.run(fill_vector, sizes);
+        mc.print();
+        ok &= mc.check(MemComplexity::PEAK, MemComplexity::ON);
+        ok &= mc.check(MemComplexity::ALLOCS, MemComplexity::OlogN);
+    }
+    {
+        MemComplexity mc("fill_set");
+        mc.run(fill_set, sizes);
+        mc.print();
+        ok &= mc.check(MemComplexity::PEAK, MemComplexity::ON);
+    }
+    {
+        // the quadratic one is caught by the check with smaller sizes
+        MemComplexity mc("triangle");
+        mc.run(triangle, MemComplexity::geometric(16, 1024));
+        mc.print();
+        ok &= !mc.check(MemComplexity::PEAK, MemComplexity::ON);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*****************************************************************************/
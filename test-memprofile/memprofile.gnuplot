@@ -11,4 +11,5 @@ set xlabel 'Time [s]'
 set ylabel 'Memory Usage [MiB]'
 
 plot \
-    'memprofile.txt' using 1:($2 / 1024/1024) title 'memprofile' with lines
+    'memprofile.txt' using 1:($2 / 1024/1024) title 'memprofile' with lines, \
+    'memprofile.txt' using 1:($3 / 1024/1024) title 'sampled stack' with lines
@@ -21,6 +21,7 @@
  *****************************************************************************/
 
 #include "memprofile.h"
+#include "stack_count.h"
 
 #include <vector>
 #include <set>
@@ -29,6 +30,10 @@ int main()
 {
     MemProfile mp("memprofile.txt", 0.1, 1024);
 
+    // sample the stack depth every millisecond as a third column
+    stack_count_sample_start(0.001);
+    mp.set_stack_sampler(stack_count_sample_peak);
+
     {
         std::vector<int> v;
         for (size_t i = 0; i < 10000000; ++i)
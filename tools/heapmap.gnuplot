@@ -0,0 +1,26 @@
+#!/usr/bin/env gnuplot
+#
+# Plot a heap map written by malloc_count_write_heapmap() or by
+# malloc_count_analyze -m. Each row of the image is a range of consecutive
+# pages, the color is the fraction of each page covered by live blocks. Rows
+# without live blocks are omitted, their addresses are comments in the file.
+#
+# usage: gnuplot -e "input='heapmap.txt'" heapmap.gnuplot
+
+if (!exists("input")) input = 'heapmap.txt'
+
+set terminal pdf size 28cm,18cm
+set output input.'.pdf'
+
+set title 'Heap Occupancy Map'
+set xlabel 'Page in Row'
+set ylabel 'Row (non-empty rows in address order)'
+set cblabel 'Fraction of Page Live'
+
+set cbrange [0:1]
+set palette defined (0 'white', 0.001 'light-goldenrod', 0.5 'orange', 1 'dark-red')
+set yrange [*:*] reverse
+set xrange [-0.5:*]
+unset key
+
+plot input matrix with image
@@ -0,0 +1,486 @@
+/******************************************************************************
+ * tools/malloc_count_analyze.cc
+ *
+ * Parallel offline analyzer of malloc_count trace files: peak allocation and
+ * its time, size and lifetime distributions, per-thread and cross-thread
+ * statistics, and the live set at a given time.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "trace_reader.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <map>
+#include <tr1/unordered_map>
+
+/// monotonic wall time in seconds
+static double timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// index of the power of two class of x
+static unsigned int log2_class(uint64_t x)
+{
+    unsigned int c = 0;
+    while (x > 1) { x >>= 1; ++c; }
+    return c;
+}
+
+/// live block, as recorded at its allocation
+struct Block
+{
+    uint64_t ptr, size, ts;
+    uint32_t tid;
+};
+
+typedef std::tr1::unordered_map<uint64_t, Block> block_map;
+
+/// statistics of one thread
+struct ThreadStats
+{
+    unsigned long long allocs, frees, bytes;
+    unsigned long long remote_frees;    ///< frees of other threads' blocks
+    unsigned long long freed_remotely;  ///< own blocks freed by other threads
+
+    ThreadStats()
+        : allocs(0), frees(0), bytes(0), remote_frees(0), freed_remotely(0)
+    { }
+
+    ThreadStats& operator += (const ThreadStats& o)
+    {
+        allocs += o.allocs, frees += o.frees, bytes += o.bytes;
+        remote_frees += o.remote_frees, freed_remotely += o.freed_remotely;
+        return *this;
+    }
+};
+
+typedef std::map<uint32_t, ThreadStats> thread_map;
+
+/// statistics of a range of events, which are combined in order
+struct RangeStats
+{
+    long long delta;            ///< sum of allocated minus freed bytes
+    long long max_prefix;       ///< maximum prefix sum of delta
+    uint64_t  max_prefix_ts;    ///< timestamp of maximum prefix sum
+
+    unsigned long long allocs, frees, total;
+    unsigned long long pool_allocs, pool_frees, pool_total;
+    unsigned long long size_hist[64];
+    unsigned long long life_hist[64];
+    unsigned long long life_sum, matched;
+
+    thread_map threads;
+
+    /// frees whose allocation was not in this range, in order
+    event_vector unmatched_frees;
+    /// allocations of this range which are not freed in it
+    std::vector<Block> open_blocks;
+
+    RangeStats()
+        : delta(0), max_prefix(0), max_prefix_ts(0),
+          allocs(0), frees(0), total(0),
+          pool_allocs(0), pool_frees(0), pool_total(0),
+          life_sum(0), matched(0)
+    {
+        memset(size_hist, 0, sizeof(size_hist));
+        memset(life_hist, 0, sizeof(life_hist));
+    }
+
+    /// account the lifetime of a block freed by the event
+    void match(const Block& b, const malloc_count_event& ev)
+    {
+        uint64_t life = ev.ts - b.ts;
+        ++life_hist[log2_class(life)];
+        life_sum += life;
+        ++matched;
+        if (b.tid != ev.tid) {
+            ++threads[ev.tid].remote_frees;
+            ++threads[b.tid].freed_remotely;
+        }
+    }
+};
+
+/// computes the statistics of each sorted range in parallel
+struct AnalyzeRanges
+{
+    std::vector<EventRange>*    ranges;
+    std::vector<RangeStats>*    stats;
+
+    void operator () (unsigned int i)
+    {
+        const EventRange& evs = (*ranges)[i];
+        RangeStats& rs = (*stats)[i];
+        block_map local;
+
+        for (size_t k = 0; k < evs.size(); ++k)
+        {
+            const malloc_count_event& ev = evs[k];
+            ThreadStats& ts = rs.threads[ev.tid];
+
+            if (ev.type == MALLOC_COUNT_EVENT_ALLOC)
+            {
+                rs.delta += ev.size;
+                if (rs.delta > rs.max_prefix) {
+                    rs.max_prefix = rs.delta;
+                    rs.max_prefix_ts = ev.ts;
+                }
+                ++rs.allocs;
+                rs.total += ev.size;
+                ++rs.size_hist[log2_class(ev.size)];
+                ++ts.allocs;
+                ts.bytes += ev.size;
+
+                Block& b = local[ev.ptr];
+                b.ptr = ev.ptr, b.size = ev.size, b.ts = ev.ts, b.tid = ev.tid;
+            }
+            else if (ev.type == MALLOC_COUNT_EVENT_FREE)
+            {
+                rs.delta -= ev.size;
+                ++rs.frees;
+                ++ts.frees;
+
+                block_map::iterator it = local.find(ev.ptr);
+                if (it != local.end()) {
+                    rs.match(it->second, ev);
+                    local.erase(it);
+                }
+                else {
+                    rs.unmatched_frees.push_back(ev);
+                }
+            }
+            else if (ev.type == MALLOC_COUNT_EVENT_POOL_ALLOC)
+            {
+                // logical allocations lie inside blocks, they are only
+                // added to the size histogram
+                ++rs.pool_allocs;
+                rs.pool_total += ev.size;
+                ++rs.size_hist[log2_class(ev.size)];
+            }
+            else if (ev.type == MALLOC_COUNT_EVENT_POOL_FREE)
+            {
+                ++rs.pool_frees;
+            }
+        }
+
+        rs.open_blocks.reserve(local.size());
+        for (block_map::const_iterator it = local.begin();
+             it != local.end(); ++it)
+            rs.open_blocks.push_back(it->second);
+    }
+};
+
+/// order blocks by address
+static bool block_ptr_less(const Block& a, const Block& b)
+{
+    return a.ptr < b.ptr;
+}
+
+/// print the live set, which is given as map of blocks
+static void print_live_set(const block_map& live, double at, bool list)
+{
+    unsigned long long bytes = 0, hist[64];
+    thread_map threads;
+    std::vector<Block> blocks;
+
+    memset(hist, 0, sizeof(hist));
+    for (block_map::const_iterator it = live.begin(); it != live.end(); ++it) {
+        bytes += it->second.size;
+        ++hist[log2_class(it->second.size)];
+        threads[it->second.tid].bytes += it->second.size;
+        ++threads[it->second.tid].allocs;
+        if (list) blocks.push_back(it->second);
+    }
+
+    printf("\nlive set at %.6f s: %lu blocks, %llu bytes\n",
+           at, (unsigned long)live.size(), bytes);
+    for (unsigned int c = 0; c < 64; ++c) {
+        if (!hist[c]) continue;
+        printf("  size [%12llu, %12llu) %12llu\n",
+               1ULL << c, 2ULL << c, hist[c]);
+    }
+    for (thread_map::const_iterator it = threads.begin();
+         it != threads.end(); ++it) {
+        printf("  thread %6u: %12llu blocks, %14llu bytes\n",
+               it->first, it->second.allocs, it->second.bytes);
+    }
+
+    if (list) {
+        std::sort(blocks.begin(), blocks.end(), block_ptr_less);
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            printf("  0x%012llx %12llu thread %u\n",
+                   (unsigned long long)blocks[i].ptr,
+                   (unsigned long long)blocks[i].size, blocks[i].tid);
+        }
+    }
+}
+
+/// write one row of the heap map, preceded by a comment with its address
+static void write_heapmap_row(FILE* f, uint64_t row,
+                              const std::vector<uint64_t>& cover,
+                              uint64_t page_size)
+{
+    fprintf(f, "# 0x%llx\n", (unsigned long long)row);
+    for (size_t p = 0; p < cover.size(); ++p) {
+        if (cover[p] == 0)
+            fprintf(f, "%s0", p ? " " : "");
+        else
+            fprintf(f, "%s%.3f", p ? " " : "", (double)cover[p] / page_size);
+    }
+    fprintf(f, "\n");
+}
+
+/// write the heap occupancy map of the live set in the format of
+/// malloc_count_write_heapmap(): rows of row_pages pages, each value is the
+/// fraction of a page covered by live blocks.
+static bool write_heapmap(const block_map& live, const char* path,
+                          uint64_t page_size, uint64_t row_pages)
+{
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    std::vector<Block> blocks;
+    unsigned long long bytes = 0;
+    for (block_map::const_iterator it = live.begin(); it != live.end(); ++it) {
+        blocks.push_back(it->second);
+        bytes += it->second.size;
+    }
+    std::sort(blocks.begin(), blocks.end(), block_ptr_less);
+
+    fprintf(f, "# malloc_count heap map of %lu live blocks with %llu bytes\n"
+            "# rows of %llu pages of %llu bytes, each value is the fraction of"
+            " a page covered\n# by live blocks, rows without live blocks are"
+            " omitted\n", (unsigned long)blocks.size(), bytes,
+            (unsigned long long)row_pages, (unsigned long long)page_size);
+
+    const uint64_t row_bytes = page_size * row_pages;
+    std::vector<uint64_t> cover(row_pages);
+    uint64_t row = 0;
+    bool have_row = false;
+
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        uint64_t addr = blocks[i].ptr, end = addr + blocks[i].size;
+
+        while (addr < end)
+        {
+            if (!have_row || addr - row >= row_bytes) {
+                if (have_row) write_heapmap_row(f, row, cover, page_size);
+                row = addr - addr % row_bytes;
+                std::fill(cover.begin(), cover.end(), 0);
+                have_row = true;
+            }
+
+            uint64_t page_end =
+                std::min(addr - addr % page_size + page_size, end);
+            cover[(addr - row) / page_size] += page_end - addr;
+            addr = page_end;
+        }
+    }
+    if (have_row) write_heapmap_row(f, row, cover, page_size);
+
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int num_threads = hardware_threads();
+    double live_at = -1;
+    bool list_live = false;
+    const char* path = NULL;
+    const char* heapmap = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            num_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            live_at = atof(argv[++i]);
+        else if (strcmp(argv[i], "-l") == 0)
+            list_live = true;
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            heapmap = argv[++i];
+        else
+            path = argv[i];
+    }
+
+    if (!path || num_threads == 0) {
+        fprintf(stderr, "usage: %s [-j threads] [-t seconds [-l]] [-m file]"
+                " <trace>\n"
+                "  -j  number of threads\n"
+                "  -t  print live set at this time after the first event\n"
+                "  -l  list all blocks of the live set\n"
+                "  -m  write heap map of the live set at -t or at the end\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    double ts_start = timestamp();
+
+    TraceReader trace;
+    if (!trace.open(path)) return EXIT_FAILURE;
+
+    trace.sort(num_threads);
+    std::vector<EventRange>& ranges = trace.ranges();
+    double ts_sorted = timestamp();
+
+    std::vector<RangeStats> stats(num_threads);
+    AnalyzeRanges ar = { &ranges, &stats };
+    parallel_for(num_threads, ar);
+
+    // combine ranges in order: peak by prefix sums, matching of frees to
+    // allocations of earlier ranges, and the live set at the requested time.
+    const uint64_t first_ts = trace.first_ts();
+    const uint64_t live_ts = first_ts + (uint64_t)(live_at * 1e9);
+
+    RangeStats all;
+    block_map open;
+    long long base = 0, peak = 0;
+    uint64_t peak_ts = first_ts;
+    unsigned long long untraced_frees = 0;
+    bool live_done = (live_at < 0);
+
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        RangeStats& rs = stats[i];
+
+        if (!live_done && !ranges[i].empty() &&
+            (ranges[i].back().ts > live_ts || i + 1 == stats.size()))
+        {
+            // replay this range up to the requested time on a copy
+            block_map live = open;
+            for (size_t k = 0; k < ranges[i].size(); ++k) {
+                const malloc_count_event& ev = ranges[i][k];
+                if (ev.ts > live_ts) break;
+                if (ev.type == MALLOC_COUNT_EVENT_ALLOC) {
+                    Block& b = live[ev.ptr];
+                    b.ptr = ev.ptr, b.size = ev.size, b.ts = ev.ts;
+                    b.tid = ev.tid;
+                }
+                else if (ev.type == MALLOC_COUNT_EVENT_FREE) {
+                    live.erase(ev.ptr);
+                }
+            }
+            print_live_set(live, live_at, list_live);
+            if (heapmap) write_heapmap(live, heapmap, 4096, 64);
+            live_done = true;
+        }
+
+        if (base + rs.max_prefix > peak) {
+            peak = base + rs.max_prefix;
+            peak_ts = rs.max_prefix_ts;
+        }
+        base += rs.delta;
+
+        for (size_t k = 0; k < rs.unmatched_frees.size(); ++k)
+        {
+            const malloc_count_event& ev = rs.unmatched_frees[k];
+            block_map::iterator it = open.find(ev.ptr);
+            if (it == open.end()) {
+                ++untraced_frees;
+                continue;
+            }
+            all.match(it->second, ev);
+            open.erase(it);
+        }
+        for (size_t k = 0; k < rs.open_blocks.size(); ++k)
+            open[rs.open_blocks[k].ptr] = rs.open_blocks[k];
+
+        all.allocs += rs.allocs, all.frees += rs.frees, all.total += rs.total;
+        all.pool_allocs += rs.pool_allocs, all.pool_frees += rs.pool_frees;
+        all.pool_total += rs.pool_total;
+        all.life_sum += rs.life_sum, all.matched += rs.matched;
+        for (unsigned int c = 0; c < 64; ++c) {
+            all.size_hist[c] += rs.size_hist[c];
+            all.life_hist[c] += rs.life_hist[c];
+        }
+        for (thread_map::const_iterator it = rs.threads.begin();
+             it != rs.threads.end(); ++it)
+            all.threads[it->first] += it->second;
+    }
+
+    // the requested time is after the last event, or the ranges from there
+    // on are empty: the live set is the final one
+    if (!live_done) {
+        print_live_set(open, live_at, list_live);
+        if (heapmap) write_heapmap(open, heapmap, 4096, 64);
+    }
+    if (heapmap && live_at < 0) write_heapmap(open, heapmap, 4096, 64);
+
+    double ts_done = timestamp();
+
+    printf("trace %s: %lu events, analyzed with %u threads in %.3f s"
+           " (sorting %.3f s)\n",
+           path, (unsigned long)trace.num_events(), num_threads,
+           ts_done - ts_start, ts_sorted - ts_start);
+
+    printf("\ntotal %llu bytes in %llu allocations, %llu frees\n",
+           all.total, all.allocs, all.frees);
+    printf("peak %lld bytes at %.6f s, final %lld bytes in %lu blocks\n",
+           peak, (peak_ts - first_ts) / 1e9, base,
+           (unsigned long)open.size());
+    if (all.pool_allocs)
+        printf("pools: %llu bytes in %llu logical allocations, %llu frees\n",
+               all.pool_total, all.pool_allocs, all.pool_frees);
+    if (untraced_frees)
+        printf("%llu frees of blocks allocated before tracing started\n",
+               untraced_frees);
+
+    printf("\nsize histogram:\n");
+    for (unsigned int c = 0; c < 64; ++c) {
+        if (!all.size_hist[c]) continue;
+        printf("  [%12llu, %12llu) %12llu\n",
+               1ULL << c, 2ULL << c, all.size_hist[c]);
+    }
+
+    printf("\nlifetime histogram, mean %.9f s:\n",
+           all.matched ? all.life_sum / 1e9 / all.matched : 0.0);
+    for (unsigned int c = 0; c < 64; ++c) {
+        if (!all.life_hist[c]) continue;
+        printf("  [%12.9f, %12.9f) s %12llu\n",
+               (1ULL << c) / 1e9, (2ULL << c) / 1e9, all.life_hist[c]);
+    }
+
+    printf("\nper thread:\n%6s %12s %12s %14s %14s %14s\n",
+           "thread", "allocs", "frees", "bytes",
+           "remote frees", "freed remotely");
+    for (thread_map::const_iterator it = all.threads.begin();
+         it != all.threads.end(); ++it)
+    {
+        printf("%6u %12llu %12llu %14llu %14llu %14llu\n",
+               it->first, it->second.allocs, it->second.frees,
+               it->second.bytes, it->second.remote_frees,
+               it->second.freed_remotely);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
@@ -0,0 +1,408 @@
+/******************************************************************************
+ * tools/malloc_count_monitor.cc
+ *
+ * Analyzer process which attaches to the shared memory rings of a program
+ * running malloc_count with MALLOC_COUNT_STREAM, consumes its allocation
+ * events in real time and prints live reports.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "malloc_count_event.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <tr1/unordered_map>
+
+/// monotonic wall time in seconds
+static double timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// order events by their timestamp
+static bool event_ts_less(const malloc_count_event& a,
+                          const malloc_count_event& b)
+{
+    return a.ts < b.ts;
+}
+
+/// index of the power of two size class of size
+static unsigned int size_class(uint64_t size)
+{
+    unsigned int c = 0;
+    while (size > 1) { size >>= 1; ++c; }
+    return c;
+}
+
+/// aggregated statistics of one thread
+struct ThreadStats
+{
+    unsigned long long allocs, frees, bytes, remote_frees;
+    long long curr;
+
+    ThreadStats() : allocs(0), frees(0), bytes(0), remote_frees(0), curr(0) { }
+};
+
+/// live block, as recorded at its allocation
+struct Block
+{
+    uint64_t size, ts;
+    uint32_t tid;
+};
+
+/**
+ * Monitor consumes the events of all rings and maintains the live state. The
+ * events of one polling round are sorted by timestamp, since rings are drained
+ * one after another. A free whose allocation has not been seen yet is held
+ * back until the allocation arrives, for at most one further round. Frees
+ * whose allocation never arrives, e.g. it was made before attaching or its
+ * event was dropped, and allocations replacing a block whose free was
+ * dropped are counted as unmatched.
+ */
+class Monitor
+{
+protected:
+    malloc_count_stream_header* m_header;
+
+    std::vector<malloc_count_event> m_batch;
+
+    typedef std::tr1::unordered_map<uint64_t, Block> live_type;
+    live_type m_live;
+
+    typedef std::tr1::unordered_map<uint64_t, malloc_count_event> pending_type;
+    pending_type m_pending;
+
+    std::map<uint32_t, ThreadStats> m_threads;
+
+    long long m_curr, m_peak;
+    unsigned long long m_total, m_allocs, m_frees, m_remote_frees;
+    unsigned long long m_pool_total, m_pool_allocs, m_pool_frees;
+    unsigned long long m_lifetime_sum;
+    unsigned long long m_unmatched_frees, m_unmatched_allocs;
+    unsigned long long m_hist[64];
+
+    uint64_t m_first_ts, m_peak_ts;
+
+public:
+    explicit Monitor(malloc_count_stream_header* header)
+        : m_header(header), m_curr(0), m_peak(0), m_total(0), m_allocs(0),
+          m_frees(0), m_remote_frees(0),
+          m_pool_total(0), m_pool_allocs(0), m_pool_frees(0),
+          m_lifetime_sum(0), m_unmatched_frees(0), m_unmatched_allocs(0),
+          m_first_ts(0), m_peak_ts(0)
+    {
+        memset(m_hist, 0, sizeof(m_hist));
+    }
+
+    /// drain all rings, returns the number of events consumed
+    size_t poll()
+    {
+        m_batch.clear();
+
+        for (uint64_t i = 0; i < m_header->num_rings; ++i)
+        {
+            malloc_count_stream_ring* r = MALLOC_COUNT_STREAM_RING(m_header, i);
+            malloc_count_event* events = MALLOC_COUNT_STREAM_EVENTS(r);
+
+            uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            uint64_t tail = r->tail;
+
+            for ( ; tail != head; ++tail)
+                m_batch.push_back(events[tail & (m_header->capacity - 1)]);
+
+            __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+        }
+
+        std::sort(m_batch.begin(), m_batch.end(), event_ts_less);
+
+        for (size_t i = 0; i < m_batch.size(); ++i)
+            process(m_batch[i]);
+
+        // frees held back from earlier rounds will not be matched anymore
+        if (!m_batch.empty())
+            expire_pending(m_batch.front().ts);
+
+        return m_batch.size();
+    }
+
+    /// drop pending frees older than ts and count them as unmatched
+    void expire_pending(uint64_t ts)
+    {
+        for (pending_type::iterator p = m_pending.begin();
+             p != m_pending.end(); )
+        {
+            if (p->second.ts < ts) {
+                ++m_unmatched_frees;
+                m_pending.erase(p++);
+            }
+            else
+                ++p;
+        }
+    }
+
+    void process(const malloc_count_event& ev)
+    {
+        if (!m_first_ts) m_first_ts = ev.ts;
+
+        ThreadStats& ts = m_threads[ev.tid];
+
+        if (ev.type == MALLOC_COUNT_EVENT_ALLOC)
+        {
+            m_curr += ev.size;
+            m_total += ev.size;
+            ++m_allocs;
+            ++m_hist[size_class(ev.size)];
+            ++ts.allocs;
+            ts.bytes += ev.size;
+            ts.curr += ev.size;
+
+            if (m_curr > m_peak) {
+                m_peak = m_curr;
+                m_peak_ts = ev.ts;
+            }
+
+            // a live block at the same address lost its free event
+            live_type::iterator it = m_live.find(ev.ptr);
+            if (it != m_live.end()) {
+                m_curr -= it->second.size;
+                m_threads[it->second.tid].curr -= it->second.size;
+                ++m_unmatched_allocs;
+            }
+
+            Block& b = m_live[ev.ptr];
+            b.size = ev.size, b.ts = ev.ts, b.tid = ev.tid;
+
+            // match a free which was consumed before this allocation. An
+            // older one belongs to an allocation which was never seen.
+            pending_type::iterator p = m_pending.find(ev.ptr);
+            if (p != m_pending.end()) {
+                malloc_count_event fev = p->second;
+                m_pending.erase(p);
+                if (fev.ts >= ev.ts)
+                    process(fev);
+                else
+                    ++m_unmatched_frees;
+            }
+        }
+        else if (ev.type == MALLOC_COUNT_EVENT_FREE)
+        {
+            live_type::iterator it = m_live.find(ev.ptr);
+            if (it == m_live.end()) {
+                pending_type::iterator p = m_pending.find(ev.ptr);
+                if (p != m_pending.end()) {
+                    ++m_unmatched_frees;
+                    p->second = ev;
+                }
+                else
+                    m_pending[ev.ptr] = ev;
+                return;
+            }
+
+            m_curr -= ev.size;
+            ++m_frees;
+            ++ts.frees;
+            m_lifetime_sum += ev.ts - it->second.ts;
+            m_threads[it->second.tid].curr -= ev.size;
+
+            if (it->second.tid != ev.tid) {
+                ++m_remote_frees;
+                ++ts.remote_frees;
+            }
+            m_live.erase(it);
+        }
+        else if (ev.type == MALLOC_COUNT_EVENT_POOL_ALLOC)
+        {
+            // logical allocations lie inside blocks, they are only added to
+            // the size histogram
+            m_pool_total += ev.size;
+            ++m_pool_allocs;
+            ++m_hist[size_class(ev.size)];
+        }
+        else if (ev.type == MALLOC_COUNT_EVENT_POOL_FREE)
+        {
+            ++m_pool_frees;
+        }
+    }
+
+    unsigned long long dropped() const
+    {
+        unsigned long long d = m_header->dropped_norings;
+        for (uint64_t i = 0; i < m_header->num_rings; ++i)
+            d += MALLOC_COUNT_STREAM_RING(m_header, i)->dropped;
+        return d;
+    }
+
+    /// print one line of live statistics, rates are relative to the previous
+    void print_line(double elapsed, double interval,
+                    unsigned long long prev_allocs,
+                    unsigned long long prev_frees)
+    {
+        printf("[%8.2f s] current %12lld, peak %12lld, allocs/s %10.0f,"
+               " frees/s %10.0f, live %9lu, remote frees %10llu,"
+               " dropped %llu\n",
+               elapsed, m_curr, m_peak,
+               (m_allocs - prev_allocs) / interval,
+               (m_frees - prev_frees) / interval,
+               (unsigned long)m_live.size(), m_remote_frees, dropped());
+        fflush(stdout);
+    }
+
+    /// print the final report with histogram and per-thread statistics
+    void print_report()
+    {
+        printf("\ntotal %llu bytes in %llu allocations, %llu frees,"
+               " peak %lld at %.6f s, mean lifetime %.6f s\n",
+               m_total, m_allocs, m_frees, m_peak,
+               (m_peak_ts - m_first_ts) / 1e9,
+               m_frees ? m_lifetime_sum / 1e9 / m_frees : 0.0);
+        if (m_pool_allocs)
+            printf("pools: %llu bytes in %llu logical allocations,"
+                   " %llu frees\n", m_pool_total, m_pool_allocs,
+                   m_pool_frees);
+        if (m_unmatched_frees + m_pending.size() || m_unmatched_allocs)
+            printf("unmatched: %llu frees without allocation, %llu"
+                   " allocations replacing a block without free\n",
+                   m_unmatched_frees + (unsigned long long)m_pending.size(),
+                   m_unmatched_allocs);
+
+        printf("\nsize histogram:\n");
+        for (unsigned int c = 0; c < 64; ++c) {
+            if (!m_hist[c]) continue;
+            printf("  [%12llu, %12llu) %12llu\n",
+                   1ULL << c, 2ULL << c, m_hist[c]);
+        }
+
+        printf("\nper thread:\n%6s %12s %12s %14s %12s %12s\n",
+               "thread", "allocs", "frees", "bytes", "current", "remote");
+        for (std::map<uint32_t, ThreadStats>::const_iterator
+                 it = m_threads.begin(); it != m_threads.end(); ++it)
+        {
+            printf("%6u %12llu %12llu %14llu %12lld %12llu\n",
+                   it->first, it->second.allocs, it->second.frees,
+                   it->second.bytes, it->second.curr,
+                   it->second.remote_frees);
+        }
+    }
+
+    unsigned long long allocs() const { return m_allocs; }
+    unsigned long long frees() const { return m_frees; }
+};
+
+/// map the shared memory object of pid, waiting for it to appear
+static malloc_count_stream_header* attach(const char* pid, double wait)
+{
+    char name[64];
+    snprintf(name, sizeof(name), MALLOC_COUNT_STREAM_NAME "%s", pid);
+
+    double start = timestamp();
+    int fd;
+    while ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+        if (timestamp() - start > wait) {
+            fprintf(stderr, "could not open shm %s\n", name);
+            return NULL;
+        }
+        usleep(10000);
+    }
+
+    malloc_count_stream_header* h = (malloc_count_stream_header*)
+        mmap(NULL, sizeof(*h), PROT_READ, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED ||
+        __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) !=
+        MALLOC_COUNT_STREAM_MAGIC)
+    {
+        fprintf(stderr, "shm %s is not a malloc_count stream\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    size_t bytes = sizeof(*h) + h->num_rings * h->ring_bytes;
+    munmap(h, sizeof(*h));
+
+    h = (malloc_count_stream_header*)
+        mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return (h == MAP_FAILED) ? NULL : h;
+}
+
+int main(int argc, char* argv[])
+{
+    double interval = 1.0;
+    const char* pid = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval = atof(argv[++i]);
+        else
+            pid = argv[i];
+    }
+
+    if (!pid) {
+        fprintf(stderr, "usage: %s [-i interval] <pid>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    malloc_count_stream_header* header = attach(pid, 10.0);
+    if (!header) return EXIT_FAILURE;
+
+    Monitor mon(header);
+
+    double start = timestamp(), last = start;
+    unsigned long long prev_allocs = 0, prev_frees = 0;
+
+    while (true)
+    {
+        bool finished = __atomic_load_n(&header->finished, __ATOMIC_ACQUIRE);
+
+        if (mon.poll() == 0) {
+            if (finished) break;
+            usleep(1000);
+        }
+
+        double now = timestamp();
+        if (now - last >= interval) {
+            mon.print_line(now - start, now - last, prev_allocs, prev_frees);
+            prev_allocs = mon.allocs(), prev_frees = mon.frees();
+            last = now;
+        }
+    }
+
+    double now = timestamp();
+    mon.print_line(now - start, now - last, prev_allocs, prev_frees);
+    mon.print_report();
+
+    return 0;
+}
+
+/*****************************************************************************/
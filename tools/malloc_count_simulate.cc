@@ -0,0 +1,569 @@
+/******************************************************************************
+ * tools/malloc_count_simulate.cc
+ *
+ * Replays a malloc_count trace file against models of allocator policies:
+ * size class sets, slab sizes, arena counts, and bump arenas. No allocator is
+ * called, each policy only keeps books on its simulated memory, and reports
+ * its footprint, fragmentation and metadata overhead.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "trace_reader.h"
+
+#include <string.h>
+
+#include <set>
+#include <string>
+#include <tr1/unordered_map>
+
+/// size of pages for large allocations
+static const uint64_t page_size = 4096;
+
+/// marks objects which are not in a slab or chunk
+static const uint32_t span_large = ~0u;
+
+/// round x up to a multiple of a
+static uint64_t round_up(uint64_t x, uint64_t a)
+{
+    return (x + a - 1) / a * a;
+}
+
+/// parse a size with optional k, m or g suffix
+static uint64_t parse_size(const std::string& s)
+{
+    char* end;
+    uint64_t x = strtoull(s.c_str(), &end, 10);
+    if (*end == 'k' || *end == 'K') x <<= 10;
+    else if (*end == 'm' || *end == 'M') x <<= 20;
+    else if (*end == 'g' || *end == 'G') x <<= 30;
+    return x;
+}
+
+/// memory of a policy, the footprint consists of live, internal, metadata and
+/// external bytes.
+struct Usage
+{
+    long long footprint;        ///< bytes obtained from the system
+    long long live;             ///< bytes requested by the program
+    long long rounded;          ///< bytes of the objects' size classes
+    long long metadata;         ///< bytes of headers and bitmaps
+    long long spans;            ///< number of slabs, chunks and large objects
+
+    Usage() : footprint(0), live(0), rounded(0), metadata(0), spans(0) { }
+};
+
+/// object as placed by a policy
+struct Object
+{
+    uint32_t span;              ///< slab or chunk, or span_large
+    uint64_t size, rounded;
+};
+
+/**
+ * Base class of the modelled policies. Derived classes place objects into
+ * spans and update m_cur, the base keeps the peak and the object map.
+ */
+class Policy
+{
+protected:
+    std::string m_spec;
+    unsigned int m_arenas;
+
+    Usage m_cur, m_peak;
+    long long m_peak_live;
+
+    typedef std::tr1::unordered_map<uint64_t, Object> object_map;
+    object_map m_objects;
+
+    unsigned long long m_untraced;
+
+    /// arena of a thread, zero arenas means one per thread
+    unsigned int arena(uint32_t tid) const
+    {
+        return m_arenas ? tid % m_arenas : tid;
+    }
+
+    void alloc_large(Object& o)
+    {
+        o.span = span_large;
+        o.rounded = round_up(o.size, page_size);
+        m_cur.footprint += o.rounded + large_header;
+        m_cur.metadata += large_header;
+        ++m_cur.spans;
+    }
+
+    void free_large(const Object& o)
+    {
+        m_cur.footprint -= o.rounded + large_header;
+        m_cur.metadata -= large_header;
+        --m_cur.spans;
+    }
+
+    virtual void place(Object& o, uint32_t tid) = 0;
+    virtual void release(const Object& o) = 0;
+
+public:
+    /// descriptor of each large allocation
+    static const uint64_t large_header = 64;
+
+    Policy(const std::string& spec, unsigned int arenas)
+        : m_spec(spec), m_arenas(arenas), m_peak_live(0), m_untraced(0)
+    { }
+
+    virtual ~Policy() { }
+
+    void replay(const malloc_count_event& ev)
+    {
+        if (ev.type == MALLOC_COUNT_EVENT_ALLOC)
+        {
+            Object& o = m_objects[ev.ptr];
+            o.size = ev.size;
+            place(o, ev.tid);
+            m_cur.live += o.size;
+            m_cur.rounded += o.rounded;
+
+            if (m_cur.footprint > m_peak.footprint) m_peak = m_cur;
+            if (m_cur.live > m_peak_live) m_peak_live = m_cur.live;
+        }
+        else if (ev.type == MALLOC_COUNT_EVENT_FREE)
+        {
+            object_map::iterator it = m_objects.find(ev.ptr);
+            if (it == m_objects.end()) {
+                ++m_untraced;
+                return;
+            }
+            release(it->second);
+            m_cur.live -= it->second.size;
+            m_cur.rounded -= it->second.rounded;
+            m_objects.erase(it);
+        }
+    }
+
+    static void print_header()
+    {
+        printf("%-40s %12s %12s %7s %7s %7s %7s %8s %12s\n",
+               "policy", "peak_bytes", "peak_live", "live%", "intern%",
+               "meta%", "extern%", "ratio", "final_bytes");
+    }
+
+    void print() const
+    {
+        double f = m_peak.footprint ? 100.0 / m_peak.footprint : 0;
+        printf("%-40s %12lld %12lld %7.2f %7.2f %7.2f %7.2f %8.3f %12lld\n",
+               m_spec.c_str(), m_peak.footprint, m_peak_live,
+               m_peak.live * f, (m_peak.rounded - m_peak.live) * f,
+               m_peak.metadata * f,
+               (m_peak.footprint - m_peak.rounded - m_peak.metadata) * f,
+               m_peak_live ? (double)m_peak.footprint / m_peak_live : 0.0,
+               m_cur.footprint);
+    }
+
+    unsigned long long untraced() const { return m_untraced; }
+};
+
+/**
+ * Segregated size classes: each arena carves objects of one class out of
+ * slabs of fixed size, which start with a header and an allocation bitmap.
+ * Objects go into the lowest-numbered slab with a free slot, and empty slabs
+ * are returned. Objects larger than the largest class get their own pages.
+ */
+class SlabPolicy : public Policy
+{
+protected:
+    std::vector<uint64_t> m_classes;
+    uint64_t m_slab_bytes, m_slab_header;
+
+    struct Slab
+    {
+        uint32_t key, used, capacity;
+        uint64_t metadata;
+    };
+
+    std::vector<Slab> m_slabs;
+    std::vector<uint32_t> m_free_ids;
+
+    /// slabs with free slots for each arena and class
+    typedef std::tr1::unordered_map<uint64_t, std::set<uint32_t> > partial_map;
+    partial_map m_partial;
+
+    void place(Object& o, uint32_t tid)
+    {
+        std::vector<uint64_t>::const_iterator c =
+            std::lower_bound(m_classes.begin(), m_classes.end(), o.size);
+        if (c == m_classes.end())
+            return alloc_large(o);
+
+        uint32_t cls = c - m_classes.begin();
+        uint64_t key = (uint64_t)arena(tid) * m_classes.size() + cls;
+        std::set<uint32_t>& partial = m_partial[key];
+
+        if (partial.empty())
+        {
+            uint32_t id;
+            if (m_free_ids.empty()) {
+                id = m_slabs.size();
+                m_slabs.push_back(Slab());
+            }
+            else {
+                id = m_free_ids.back();
+                m_free_ids.pop_back();
+            }
+
+            // header and one bitmap bit per slot share the slab with slots
+            Slab& s = m_slabs[id];
+            s.key = key, s.used = 0;
+            s.capacity = (m_slab_bytes - m_slab_header) * 8 / (*c * 8 + 1);
+            s.metadata = m_slab_header + (s.capacity + 7) / 8;
+
+            m_cur.footprint += m_slab_bytes;
+            m_cur.metadata += s.metadata;
+            ++m_cur.spans;
+            partial.insert(id);
+        }
+
+        uint32_t id = *partial.begin();
+        Slab& s = m_slabs[id];
+        if (++s.used == s.capacity) partial.erase(partial.begin());
+
+        o.span = id;
+        o.rounded = *c;
+    }
+
+    void release(const Object& o)
+    {
+        if (o.span == span_large)
+            return free_large(o);
+
+        Slab& s = m_slabs[o.span];
+        if (s.used-- == s.capacity)
+            m_partial[s.key].insert(o.span);
+
+        if (s.used == 0) {
+            m_partial[s.key].erase(o.span);
+            m_cur.footprint -= m_slab_bytes;
+            m_cur.metadata -= s.metadata;
+            --m_cur.spans;
+            m_free_ids.push_back(o.span);
+        }
+    }
+
+public:
+    SlabPolicy(const std::string& spec, unsigned int arenas,
+               const std::vector<uint64_t>& classes,
+               uint64_t slab_bytes, uint64_t slab_header)
+        : Policy(spec, arenas), m_classes(classes),
+          m_slab_bytes(slab_bytes), m_slab_header(slab_header)
+    { }
+};
+
+/**
+ * Bump arenas: each arena allocates objects with a header consecutively from
+ * its current chunk and starts a new chunk when it is full. A chunk is
+ * returned only when all its objects are freed and it is not current. Objects
+ * larger than a quarter chunk get their own pages.
+ */
+class BumpPolicy : public Policy
+{
+protected:
+    uint64_t m_chunk_bytes, m_header, m_align;
+
+    struct Chunk
+    {
+        uint32_t live;
+        bool current;
+    };
+
+    std::vector<Chunk> m_chunks;
+    std::vector<uint32_t> m_free_ids;
+
+    /// current chunk and its fill of each arena
+    struct Cursor
+    {
+        uint32_t chunk;
+        uint64_t offset;
+    };
+
+    std::tr1::unordered_map<uint32_t, Cursor> m_cursors;
+
+    void release_chunk(uint32_t id)
+    {
+        m_cur.footprint -= m_chunk_bytes;
+        --m_cur.spans;
+        m_free_ids.push_back(id);
+    }
+
+    void place(Object& o, uint32_t tid)
+    {
+        uint64_t need = round_up(o.size + m_header, m_align);
+        if (need > m_chunk_bytes / 4)
+            return alloc_large(o);
+
+        std::tr1::unordered_map<uint32_t, Cursor>::iterator it =
+            m_cursors.find(arena(tid));
+
+        if (it == m_cursors.end() || it->second.offset + need > m_chunk_bytes)
+        {
+            if (it == m_cursors.end()) {
+                it = m_cursors.insert(
+                    std::make_pair(arena(tid), Cursor())).first;
+            }
+            else {
+                Chunk& old = m_chunks[it->second.chunk];
+                old.current = false;
+                if (old.live == 0) release_chunk(it->second.chunk);
+            }
+
+            uint32_t id;
+            if (m_free_ids.empty()) {
+                id = m_chunks.size();
+                m_chunks.push_back(Chunk());
+            }
+            else {
+                id = m_free_ids.back();
+                m_free_ids.pop_back();
+            }
+            m_chunks[id].live = 0;
+            m_chunks[id].current = true;
+            m_cur.footprint += m_chunk_bytes;
+            ++m_cur.spans;
+
+            it->second.chunk = id;
+            it->second.offset = 0;
+        }
+
+        ++m_chunks[it->second.chunk].live;
+        it->second.offset += need;
+
+        o.span = it->second.chunk;
+        o.rounded = need - m_header;
+        m_cur.metadata += m_header;
+    }
+
+    void release(const Object& o)
+    {
+        if (o.span == span_large)
+            return free_large(o);
+
+        m_cur.metadata -= m_header;
+        Chunk& c = m_chunks[o.span];
+        if (--c.live == 0 && !c.current)
+            release_chunk(o.span);
+    }
+
+public:
+    BumpPolicy(const std::string& spec, unsigned int arenas,
+               uint64_t chunk_bytes, uint64_t header, uint64_t align)
+        : Policy(spec, arenas), m_chunk_bytes(chunk_bytes),
+          m_header(header), m_align(align)
+    { }
+};
+
+/// size classes up to max: "pow2", "quarter" (four per power of two), or a
+/// number for equally spaced classes.
+static std::vector<uint64_t> make_classes(const std::string& name,
+                                          uint64_t max)
+{
+    std::vector<uint64_t> classes;
+
+    if (name == "pow2") {
+        for (uint64_t c = 16; c <= max; c *= 2)
+            classes.push_back(c);
+    }
+    else if (name == "quarter") {
+        for (uint64_t c = 16; c <= 64 && c <= max; c += 16)
+            classes.push_back(c);
+        for (uint64_t base = 64; base < max; base *= 2) {
+            for (uint64_t k = 1; k <= 4 && base + k * base / 4 <= max; ++k)
+                classes.push_back(base + k * base / 4);
+        }
+    }
+    else {
+        uint64_t step = parse_size(name);
+        if (step == 0) return classes;
+        for (uint64_t c = step; c <= max; c += step)
+            classes.push_back(c);
+    }
+    return classes;
+}
+
+/**
+ * Construct a policy from its specification "slab:key=value,..." or
+ * "bump:key=value,...". Returns NULL on errors.
+ */
+static Policy* make_policy(const std::string& spec)
+{
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::string classes = "quarter";
+    uint64_t slab = 64 << 10, max = 0, header = 0, chunk = 1 << 20;
+    uint64_t align = 16, arenas = 1;
+    bool has_header = false;
+
+    size_t p = spec.find(':');
+    while (p != std::string::npos)
+    {
+        size_t q = spec.find(',', p + 1);
+        std::string kv = spec.substr(p + 1, q == std::string::npos ?
+                                     std::string::npos : q - p - 1);
+        size_t eq = kv.find('=');
+        std::string key = kv.substr(0, eq), val;
+        if (eq != std::string::npos) val = kv.substr(eq + 1);
+
+        if (key == "classes") classes = val;
+        else if (key == "slab") slab = parse_size(val);
+        else if (key == "max") max = parse_size(val);
+        else if (key == "chunk") chunk = parse_size(val);
+        else if (key == "header") header = parse_size(val), has_header = true;
+        else if (key == "align") align = parse_size(val);
+        else if (key == "arenas") arenas = parse_size(val);
+        else {
+            fprintf(stderr, "unknown parameter %s in policy %s\n",
+                    key.c_str(), spec.c_str());
+            return NULL;
+        }
+        p = q;
+    }
+
+    if (kind == "slab")
+    {
+        if (!has_header) header = 64;
+        if (!max) max = slab / 8;
+        std::vector<uint64_t> cls = make_classes(classes, max);
+        if (cls.empty() || slab <= header + cls.back()) {
+            fprintf(stderr, "no size classes fit into slabs in policy %s\n",
+                    spec.c_str());
+            return NULL;
+        }
+        return new SlabPolicy(spec, arenas, cls, slab, header);
+    }
+    else if (kind == "bump")
+    {
+        if (!has_header) header = 16;
+        if (align == 0 || chunk < 4 * align) {
+            fprintf(stderr, "invalid chunk or alignment in policy %s\n",
+                    spec.c_str());
+            return NULL;
+        }
+        return new BumpPolicy(spec, arenas, chunk, header, align);
+    }
+
+    fprintf(stderr, "unknown policy %s\n", spec.c_str());
+    return NULL;
+}
+
+/// policies compared if none are given on the command line
+static const char* default_policies[] = {
+    "slab:classes=pow2",
+    "slab:classes=quarter",
+    "slab:classes=16",
+    "slab:classes=quarter,slab=16k",
+    "slab:classes=quarter,slab=256k",
+    "slab:classes=quarter,arenas=4",
+    "slab:classes=quarter,arenas=0",
+    "bump:chunk=64k",
+    "bump:chunk=1m",
+    "bump:chunk=1m,arenas=0",
+    NULL
+};
+
+/// replays all events in each policy, in parallel over policies
+struct ReplayPolicies
+{
+    std::vector<EventRange>*    ranges;
+    std::vector<Policy*>*       policies;
+
+    void operator () (unsigned int i)
+    {
+        Policy* p = (*policies)[i];
+        for (size_t r = 0; r < ranges->size(); ++r) {
+            const EventRange& evs = (*ranges)[r];
+            for (size_t k = 0; k < evs.size(); ++k)
+                p->replay(evs[k]);
+        }
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    unsigned int num_threads = hardware_threads();
+    std::vector<std::string> specs;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            num_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            specs.push_back(argv[++i]);
+        else
+            path = argv[i];
+    }
+
+    if (!path || num_threads == 0) {
+        fprintf(stderr,
+                "usage: %s [-j threads] [-p policy]... <trace>\n"
+                "  -j  number of threads for sorting\n"
+                "  -p  policy to simulate, one of\n"
+                "      slab:classes=C,slab=S,max=M,header=H,arenas=A\n"
+                "      bump:chunk=S,header=H,align=N,arenas=A\n"
+                "      C is pow2, quarter, or a class spacing in bytes;"
+                " A=0 is one arena per thread\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (specs.empty()) {
+        for (const char** d = default_policies; *d; ++d)
+            specs.push_back(*d);
+    }
+
+    std::vector<Policy*> policies;
+    for (size_t i = 0; i < specs.size(); ++i) {
+        Policy* p = make_policy(specs[i]);
+        if (!p) return EXIT_FAILURE;
+        policies.push_back(p);
+    }
+
+    TraceReader trace;
+    if (!trace.open(path)) return EXIT_FAILURE;
+
+    trace.sort(num_threads);
+
+    ReplayPolicies rp = { &trace.ranges(), &policies };
+    parallel_for(policies.size(), rp);
+
+    printf("trace %s: %lu events, %lu policies\n",
+           path, (unsigned long)trace.num_events(),
+           (unsigned long)policies.size());
+    if (policies[0]->untraced())
+        printf("%llu frees of blocks allocated before tracing started\n",
+               policies[0]->untraced());
+    printf("\n");
+
+    Policy::print_header();
+    for (size_t i = 0; i < policies.size(); ++i) {
+        policies[i]->print();
+        delete policies[i];
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
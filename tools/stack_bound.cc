@@ -0,0 +1,545 @@
+/******************************************************************************
+ * tools/stack_bound.cc
+ *
+ * Computes worst-case stack bounds of thread entry functions from the frame
+ * sizes GCC writes with -fstack-usage (.su) and the call graph it writes with
+ * -fcallgraph-info=su (.ci), and compares them with high-water marks measured
+ * at run time by stack_count.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+/// node GCC emits for calls through function pointers
+static const char* indirect_name = "__indirect_call";
+
+/// flags of a bound: what it does not cover
+enum {
+    FLAG_RECURSION = 1,         ///< a recursive cycle, counted once
+    FLAG_DYNAMIC = 2,           ///< a frame with unbounded dynamic size
+    FLAG_INDIRECT = 4,          ///< a call through a function pointer
+    FLAG_UNKNOWN = 8            ///< a callee without frame size
+};
+
+/// function in the call graph
+struct Function
+{
+    std::string name;
+    long long frame;            ///< frame bytes, or -1 if unknown
+    bool dynamic;               ///< frame has unbounded dynamic size
+    std::vector<size_t> callees;
+
+    // strongly connected component, filled by Tarjan's algorithm
+    int index, lowlink, scc;
+    bool on_stack;
+
+    Function(const std::string& n)
+        : name(n), frame(-1), dynamic(false),
+          index(-1), lowlink(0), scc(-1), on_stack(false)
+    { }
+};
+
+/// strongly connected component of the call graph
+struct Component
+{
+    std::vector<size_t> members;
+    long long bound;            ///< worst-case stack from here on
+    int flags;
+    int next;                   ///< component on the worst path, or -1
+};
+
+/**
+ * The call graph of all input files. Functions are merged by name, so static
+ * functions of the same name in different files share the larger frame and
+ * the callees of both, which keeps the bound safe.
+ */
+class CallGraph
+{
+protected:
+    std::vector<Function> m_funcs;
+    std::map<std::string, size_t> m_index;
+    std::vector<Component> m_comps;
+    std::vector<size_t> m_stack;
+    int m_counter;
+
+    /// bytes assumed for each unknown or indirect callee
+    long long m_unknown_bytes;
+
+    /// Tarjan's algorithm, components are found callees first
+    void strongconnect(size_t v)
+    {
+        Function& f = m_funcs[v];
+        f.index = f.lowlink = m_counter++;
+        m_stack.push_back(v);
+        f.on_stack = true;
+
+        for (size_t i = 0; i < m_funcs[v].callees.size(); ++i)
+        {
+            size_t w = m_funcs[v].callees[i];
+            if (m_funcs[w].index < 0) {
+                strongconnect(w);
+                m_funcs[v].lowlink =
+                    std::min(m_funcs[v].lowlink, m_funcs[w].lowlink);
+            }
+            else if (m_funcs[w].on_stack) {
+                m_funcs[v].lowlink =
+                    std::min(m_funcs[v].lowlink, m_funcs[w].index);
+            }
+        }
+
+        if (m_funcs[v].lowlink != m_funcs[v].index) return;
+
+        Component c;
+        c.bound = 0, c.flags = 0, c.next = -1;
+        size_t w;
+        do {
+            w = m_stack.back();
+            m_stack.pop_back();
+            m_funcs[w].on_stack = false;
+            m_funcs[w].scc = m_comps.size();
+            c.members.push_back(w);
+        } while (w != v);
+        m_comps.push_back(c);
+
+        evaluate(m_comps.size() - 1);
+    }
+
+    /// bound of a component whose callee components are all evaluated. The
+    /// frames of a recursive cycle are all counted once.
+    void evaluate(size_t ci)
+    {
+        Component& c = m_comps[ci];
+        long long frames = 0, below = 0;
+
+        if (c.members.size() > 1) c.flags |= FLAG_RECURSION;
+
+        for (size_t i = 0; i < c.members.size(); ++i)
+        {
+            const Function& f = m_funcs[c.members[i]];
+
+            if (f.name == indirect_name) {
+                c.flags |= FLAG_INDIRECT;
+                frames += m_unknown_bytes;
+            }
+            else if (f.frame < 0) {
+                c.flags |= FLAG_UNKNOWN;
+                frames += m_unknown_bytes;
+            }
+            else {
+                frames += f.frame;
+                if (f.dynamic) c.flags |= FLAG_DYNAMIC;
+            }
+
+            for (size_t j = 0; j < f.callees.size(); ++j)
+            {
+                int cj = m_funcs[f.callees[j]].scc;
+                if (cj == (int)ci) {
+                    c.flags |= FLAG_RECURSION;
+                    continue;
+                }
+                c.flags |= m_comps[cj].flags;
+                if (c.next < 0 || m_comps[cj].bound > below) {
+                    below = m_comps[cj].bound;
+                    c.next = cj;
+                }
+            }
+        }
+
+        c.bound = frames + below;
+    }
+
+public:
+    CallGraph(long long unknown_bytes)
+        : m_counter(0), m_unknown_bytes(unknown_bytes)
+    { }
+
+    size_t get(const std::string& name)
+    {
+        std::map<std::string, size_t>::iterator it = m_index.find(name);
+        if (it != m_index.end()) return it->second;
+        m_funcs.push_back(Function(name));
+        return (m_index[name] = m_funcs.size() - 1);
+    }
+
+    bool has(const std::string& name) const
+    {
+        return m_index.find(name) != m_index.end();
+    }
+
+    void set_frame(const std::string& name, long long frame,
+                   const std::string& qualifier)
+    {
+        Function& f = m_funcs[get(name)];
+        f.frame = std::max(f.frame, frame);
+        if (qualifier.find("dynamic") != std::string::npos &&
+            qualifier.find("bounded") == std::string::npos)
+            f.dynamic = true;
+    }
+
+    void add_call(const std::string& caller, const std::string& callee)
+    {
+        size_t a = get(caller), b = get(callee);
+        std::vector<size_t>& c = m_funcs[a].callees;
+        if (std::find(c.begin(), c.end(), b) == c.end())
+            c.push_back(b);
+    }
+
+    /// functions which are not called by any other
+    std::vector<std::string> roots() const
+    {
+        std::vector<bool> called(m_funcs.size(), false);
+        for (size_t i = 0; i < m_funcs.size(); ++i)
+            for (size_t j = 0; j < m_funcs[i].callees.size(); ++j)
+                if (m_funcs[i].callees[j] != i)
+                    called[m_funcs[i].callees[j]] = true;
+
+        std::vector<std::string> r;
+        for (size_t i = 0; i < m_funcs.size(); ++i)
+            if (!called[i] && m_funcs[i].frame >= 0)
+                r.push_back(m_funcs[i].name);
+        return r;
+    }
+
+    /// find all components and their bounds
+    void compute()
+    {
+        for (size_t v = 0; v < m_funcs.size(); ++v)
+            if (m_funcs[v].index < 0) strongconnect(v);
+    }
+
+    const Component& component(const std::string& name) const
+    {
+        return m_comps[m_funcs[m_index.find(name)->second].scc];
+    }
+
+    /// print the worst-case path from a function, one component per line
+    void print_path(const std::string& name) const
+    {
+        int ci = m_funcs[m_index.find(name)->second].scc;
+        for ( ; ci >= 0; ci = m_comps[ci].next)
+        {
+            const Component& c = m_comps[ci];
+            printf("    %10lld ", c.bound);
+            if (c.members.size() > 1) printf("recursive:");
+            for (size_t i = 0; i < c.members.size(); ++i)
+            {
+                const Function& f = m_funcs[c.members[i]];
+                if (f.frame >= 0)
+                    printf(" %s (%lld%s)", f.name.c_str(), f.frame,
+                           f.dynamic ? ", dynamic" : "");
+                else
+                    printf(" %s (?)", f.name.c_str());
+            }
+            printf("\n");
+        }
+    }
+};
+
+/// does s end with suffix
+static bool ends_with(const std::string& s, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+/// read one line without the newline, false at the end of the file
+static bool read_line(FILE* in, std::string& line)
+{
+    char buf[4096];
+    line.clear();
+    while (fgets(buf, sizeof(buf), in))
+    {
+        line += buf;
+        if (!line.empty() && line[line.size() - 1] == '\n') {
+            line.erase(line.size() - 1);
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+/// a .su line is "file:line:column:function<TAB>bytes<TAB>qualifier"
+static bool read_su(const char* path, CallGraph& cg)
+{
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "could not open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    while (read_line(in, line))
+    {
+        size_t t1 = line.find('\t');
+        size_t t2 = line.find('\t', t1 + 1);
+        if (t1 == std::string::npos || t2 == std::string::npos) continue;
+
+        // skip file, line and column, the function name may contain colons
+        size_t p = 0;
+        for (int i = 0; i < 3 && p < t1; ++i) {
+            p = line.find(':', p);
+            if (p == std::string::npos || p > t1) break;
+            ++p;
+        }
+        if (p == std::string::npos || p > t1) continue;
+
+        cg.set_frame(line.substr(p, t1 - p),
+                     atoll(line.c_str() + t1 + 1), line.substr(t2 + 1));
+    }
+
+    fclose(in);
+    return true;
+}
+
+/// extract the quoted value of key from a VCG line
+static bool vcg_field(const std::string& line, const char* key,
+                      std::string& out)
+{
+    std::string k = std::string(key) + ": \"";
+    size_t p = line.find(k);
+    if (p == std::string::npos) return false;
+    p += k.size();
+    size_t e = line.find('"', p);
+    if (e == std::string::npos) return false;
+    out = line.substr(p, e - p);
+    return true;
+}
+
+/// a .ci file is a VCG graph: node labels carry "N bytes (qualifier)" as
+/// third line if compiled with -fcallgraph-info=su
+static bool read_ci(const char* path, CallGraph& cg)
+{
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "could not open %s\n", path);
+        return false;
+    }
+
+    std::string line, title, label, source, target;
+    while (read_line(in, line))
+    {
+        if (line.compare(0, 5, "node:") == 0 && vcg_field(line, "title", title))
+        {
+            cg.get(title);
+            if (!vcg_field(line, "label", label)) continue;
+
+            // the label's lines are separated by a literal \n
+            size_t p = label.find("\\n");
+            if (p != std::string::npos) p = label.find("\\n", p + 2);
+            if (p == std::string::npos) continue;
+
+            long long bytes;
+            char qualifier[64];
+            if (sscanf(label.c_str() + p + 2, "%lld bytes (%63[^)])",
+                       &bytes, qualifier) == 2)
+                cg.set_frame(title, bytes, qualifier);
+        }
+        else if (line.compare(0, 5, "edge:") == 0 &&
+                 vcg_field(line, "sourcename", source) &&
+                 vcg_field(line, "targetname", target))
+        {
+            cg.add_call(source, target);
+        }
+    }
+
+    fclose(in);
+    return true;
+}
+
+/// a runtime file has lines "function bytes", e.g. high-water marks taken
+/// with stack_count_begin() and stack_count_end() around thread functions
+static bool read_runtime(const char* path,
+                         std::map<std::string, long long>& runtime)
+{
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "could not open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    while (read_line(in, line))
+    {
+        char name[1024];
+        long long bytes;
+        if (line.empty() || line[0] == '#') continue;
+        if (sscanf(line.c_str(), "%1023s %lld", name, &bytes) != 2) continue;
+        long long& r = runtime[name];
+        r = std::max(r, bytes);
+    }
+
+    fclose(in);
+    return true;
+}
+
+/// flags as letters, '-' for none
+static std::string flag_string(int flags)
+{
+    std::string s;
+    if (flags & FLAG_RECURSION) s += 'R';
+    if (flags & FLAG_DYNAMIC) s += 'D';
+    if (flags & FLAG_INDIRECT) s += 'I';
+    if (flags & FLAG_UNKNOWN) s += 'U';
+    return s.empty() ? "-" : s;
+}
+
+int main(int argc, char* argv[])
+{
+    long long unknown_bytes = 0, margin = 0, page = 4096;
+    bool paths = false, unknown_given = false, unbounded = false;
+    std::vector<std::string> entries;
+    std::map<std::string, long long> runtime;
+    std::vector<const char*> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+            entries.push_back(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            if (!read_runtime(argv[++i], runtime)) return EXIT_FAILURE;
+        }
+        else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            unknown_bytes = atoll(argv[++i]);
+            unknown_given = true;
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            margin = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+            page = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0)
+            paths = true;
+        else
+            inputs.push_back(argv[i]);
+    }
+
+    if (inputs.empty() || page <= 0) {
+        fprintf(stderr,
+                "usage: %s [-e entry]... [-r runtime] [-u bytes] [-m bytes]"
+                " [-g bytes] [-p] <file.su|file.ci>...\n"
+                "  -e  thread entry function, default: all uncalled"
+                " functions and those in -r\n"
+                "  -r  file of \"function bytes\" lines with measured"
+                " high-water marks\n"
+                "  -u  bytes assumed for each unknown or indirect callee,"
+                " without it bounds\n      with such callees are unbounded\n"
+                "  -m  safety margin added to the bound for the stack size\n"
+                "  -g  granularity to round the stack size to, default 4096\n"
+                "  -p  print the worst-case call path of each entry\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    CallGraph cg(unknown_bytes);
+
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::string in = inputs[i];
+        bool ok;
+        if (ends_with(in, ".su"))
+            ok = read_su(inputs[i], cg);
+        else if (ends_with(in, ".ci"))
+            ok = read_ci(inputs[i], cg);
+        else {
+            fprintf(stderr, "%s is neither a .su nor a .ci file\n", inputs[i]);
+            ok = false;
+        }
+        if (!ok) return EXIT_FAILURE;
+    }
+
+    if (entries.empty()) {
+        entries = cg.roots();
+        for (std::map<std::string, long long>::const_iterator it =
+                 runtime.begin(); it != runtime.end(); ++it)
+        {
+            if (std::find(entries.begin(), entries.end(), it->first)
+                == entries.end())
+                entries.push_back(it->first);
+        }
+    }
+
+    cg.compute();
+
+    printf("%-32s %10s %5s %10s %10s %10s\n",
+           "entry", "bound", "flags", "runtime", "slack", "stack_size");
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const std::string& e = entries[i];
+        if (!cg.has(e)) {
+            printf("%-32s %10s\n", e.c_str(), "not found");
+            continue;
+        }
+
+        const Component& c = cg.component(e);
+        long long stack = (c.bound + margin + page - 1) / page * page;
+        std::map<std::string, long long>::const_iterator r = runtime.find(e);
+
+        // without -u, unknown and indirect callees have no bound at all
+        if (!unknown_given && (c.flags & (FLAG_INDIRECT | FLAG_UNKNOWN))) {
+            printf("%-32s %10s %5s", e.c_str(), "unbounded",
+                   flag_string(c.flags).c_str());
+            if (r != runtime.end())
+                printf(" %10lld %10s %10s\n", r->second, "-", "-");
+            else
+                printf(" %10s %10s %10s\n", "-", "-", "-");
+            if (paths) cg.print_path(e);
+            unbounded = true;
+            continue;
+        }
+
+        printf("%-32s %10lld %5s", e.c_str(), c.bound,
+               flag_string(c.flags).c_str());
+
+        if (r != runtime.end())
+            printf(" %10lld %10lld", r->second, c.bound - r->second);
+        else
+            printf(" %10s %10s", "-", "-");
+
+        printf(" %10lld%s\n", stack,
+               r != runtime.end() && r->second > c.bound
+               ? "  runtime exceeds bound!" : "");
+
+        if (paths) cg.print_path(e);
+    }
+
+    printf("\nflags: R recursion counted once, D unbounded dynamic frame,"
+           " I indirect call, U unknown callee");
+    if (unknown_given)
+        printf(" (-u %lld bytes each)\n", unknown_bytes);
+    else
+        printf(" (unbounded without -u)\n");
+
+    if (unbounded) {
+        fprintf(stderr, "some entries call unknown or indirect callees,"
+                " give -u bytes to bound them\n");
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
@@ -0,0 +1,300 @@
+/******************************************************************************
+ * tools/trace_reader.h
+ *
+ * Memory-mapped reader for malloc_count trace files, which sorts the events
+ * by timestamp in parallel into consecutive ranges.
+ *
+ ******************************************************************************
+ * Copyright (C) 2026 The malloc_count Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+#ifndef _TRACE_READER_H_
+#define _TRACE_READER_H_
+
+#include "malloc_count_event.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vector>
+#include <algorithm>
+
+/// vector of events
+typedef std::vector<malloc_count_event> event_vector;
+
+/// order events by timestamp
+static inline bool event_ts_less(const malloc_count_event& a,
+                                 const malloc_count_event& b)
+{
+    return a.ts < b.ts;
+}
+
+/// sort key of an event: timestamp and index in the file
+struct event_key
+{
+    uint64_t    ts;
+    uint64_t    index;
+};
+
+/// order keys by timestamp, and equal timestamps in file order
+static inline bool event_key_less(const event_key& a, const event_key& b)
+{
+    return a.ts < b.ts || (a.ts == b.ts && a.index < b.index);
+}
+
+/// vector of sort keys
+typedef std::vector<event_key> key_vector;
+
+/// range of events in timestamp order, read through their sort keys from
+/// the mapped file
+class EventRange
+{
+public:
+    const malloc_count_event*   events;
+    key_vector                  keys;
+
+    EventRange() : events(NULL) { }
+
+    size_t size() const { return keys.size(); }
+    bool empty() const { return keys.empty(); }
+
+    const malloc_count_event& operator [] (size_t i) const
+    {
+        return events[keys[i].index];
+    }
+
+    const malloc_count_event& front() const { return (*this)[0]; }
+    const malloc_count_event& back() const { return (*this)[size() - 1]; }
+};
+
+/// thread argument of parallel_for()
+template <typename Functor>
+struct ParallelJob
+{
+    Functor*        fn;
+    unsigned int    index;
+
+    static void* run(void* arg)
+    {
+        ParallelJob* j = static_cast<ParallelJob*>(arg);
+        (*j->fn)(j->index);
+        return NULL;
+    }
+};
+
+/// run fn(i) for i = 0..num-1 in num threads and wait for them
+template <typename Functor>
+static inline void parallel_for(unsigned int num, Functor& fn)
+{
+    std::vector<pthread_t> threads(num);
+    std::vector< ParallelJob<Functor> > jobs(num);
+
+    for (unsigned int i = 0; i < num; ++i) {
+        jobs[i].fn = &fn, jobs[i].index = i;
+        pthread_create(&threads[i], NULL, ParallelJob<Functor>::run, &jobs[i]);
+    }
+    for (unsigned int i = 0; i < num; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+/// number of online processors, used as default number of threads
+static inline unsigned int hardware_threads()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int)n : 1;
+}
+
+/**
+ * TraceReader maps a trace file into memory and sorts its events in parallel
+ * by timestamp into num_ranges consecutive ranges: all events of range i have
+ * smaller timestamps than those of range i+1. Within each thread's blocks the
+ * file order is kept for equal timestamps. The ranges hold only 16 byte keys
+ * of the events, which are read from the mapping, so sorting needs 32 bytes
+ * per event and the ranges 16 bytes per event afterwards.
+ */
+class TraceReader
+{
+protected:
+    int                         m_fd;
+    void*                       m_map;
+    size_t                      m_map_bytes;
+
+    const malloc_count_event*   m_events;
+    size_t                      m_num_events;
+
+    /// events sorted by timestamp, split into ranges
+    std::vector<EventRange>     m_ranges;
+
+    /// stage 1: sort the keys of equal chunks of the file
+    struct SortChunks
+    {
+        TraceReader*                r;
+        std::vector<key_vector>*    chunks;
+
+        void operator () (unsigned int i)
+        {
+            size_t n = r->m_num_events, num = chunks->size();
+            size_t begin = i * n / num, end = (i + 1) * n / num;
+
+            key_vector& c = (*chunks)[i];
+            c.resize(end - begin);
+            for (size_t k = begin; k < end; ++k) {
+                c[k - begin].ts = r->m_events[k].ts;
+                c[k - begin].index = k;
+            }
+            std::sort(c.begin(), c.end(), event_key_less);
+        }
+    };
+
+    /// stage 2: gather the keys between two splitters from all chunks
+    struct GatherRanges
+    {
+        TraceReader*                r;
+        std::vector<key_vector>*    chunks;
+        std::vector<uint64_t>*      splitters;
+
+        void operator () (unsigned int i)
+        {
+            key_vector& keys = r->m_ranges[i].keys;
+            event_key lo, hi;
+            lo.ts = (i == 0) ? 0 : (*splitters)[i - 1], lo.index = 0;
+            hi.ts = (i + 1 == r->m_ranges.size()) ? ~0ULL : (*splitters)[i];
+            hi.index = 0;
+
+            for (size_t c = 0; c < chunks->size(); ++c)
+            {
+                key_vector& ch = (*chunks)[c];
+                key_vector::iterator b =
+                    std::lower_bound(ch.begin(), ch.end(), lo, event_key_less);
+                key_vector::iterator e =
+                    (i + 1 == r->m_ranges.size()) ? ch.end() :
+                    std::lower_bound(ch.begin(), ch.end(), hi, event_key_less);
+                keys.insert(keys.end(), b, e);
+            }
+            std::sort(keys.begin(), keys.end(), event_key_less);
+            r->m_ranges[i].events = r->m_events;
+        }
+    };
+
+public:
+    TraceReader()
+        : m_fd(-1), m_map(NULL), m_map_bytes(0),
+          m_events(NULL), m_num_events(0)
+    { }
+
+    ~TraceReader()
+    {
+        if (m_map) munmap(m_map, m_map_bytes);
+        if (m_fd >= 0) close(m_fd);
+    }
+
+    /// map the file, returns false and prints an error if it is unusable
+    bool open(const char* path)
+    {
+        struct stat st;
+
+        if ((m_fd = ::open(path, O_RDONLY)) < 0 || fstat(m_fd, &st) != 0) {
+            perror(path);
+            return false;
+        }
+        m_map_bytes = st.st_size;
+        if (m_map_bytes < sizeof(malloc_count_trace_header)) {
+            fprintf(stderr, "%s: too short for a trace\n", path);
+            return false;
+        }
+
+        m_map = mmap(NULL, m_map_bytes, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (m_map == MAP_FAILED) {
+            m_map = NULL;
+            perror(path);
+            return false;
+        }
+        // the ranges read the events scattered over the file
+        madvise(m_map, m_map_bytes, MADV_WILLNEED);
+
+        const malloc_count_trace_header* h =
+            static_cast<const malloc_count_trace_header*>(m_map);
+        if (h->magic != MALLOC_COUNT_TRACE_MAGIC ||
+            h->event_bytes != sizeof(malloc_count_event)) {
+            fprintf(stderr, "%s: not a malloc_count trace\n", path);
+            return false;
+        }
+
+        m_events = reinterpret_cast<const malloc_count_event*>(h + 1);
+        m_num_events = (m_map_bytes - sizeof(*h)) / sizeof(malloc_count_event);
+        return true;
+    }
+
+    /// sort the events in parallel into num consecutive ranges
+    void sort(unsigned int num)
+    {
+        std::vector<key_vector> chunks(num);
+        SortChunks sc = { this, &chunks };
+        parallel_for(num, sc);
+
+        // choose splitters from evenly spaced samples of the sorted chunks
+        std::vector<uint64_t> samples;
+        const size_t oversample = 16;
+        for (size_t c = 0; c < num; ++c) {
+            for (size_t k = 1; k <= oversample; ++k) {
+                if (chunks[c].empty()) break;
+                samples.push_back(
+                    chunks[c][k * (chunks[c].size() - 1) / oversample].ts);
+            }
+        }
+        std::sort(samples.begin(), samples.end());
+
+        std::vector<uint64_t> splitters;
+        for (size_t i = 1; i < num; ++i)
+            splitters.push_back(
+                samples.empty() ? 0 : samples[i * samples.size() / num]);
+
+        m_ranges.clear();
+        m_ranges.resize(num);
+        GatherRanges gr = { this, &chunks, &splitters };
+        parallel_for(num, gr);
+    }
+
+    size_t num_events() const { return m_num_events; }
+
+    /// raw events in file order
+    const malloc_count_event* events() const { return m_events; }
+
+    /// sorted ranges, valid after sort() while the reader exists
+    std::vector<EventRange>& ranges() { return m_ranges; }
+
+    /// timestamp of the first event, valid after sort()
+    uint64_t first_ts() const
+    {
+        for (size_t i = 0; i < m_ranges.size(); ++i)
+            if (!m_ranges[i].empty()) return m_ranges[i].front().ts;
+        return 0;
+    }
+};
+
+#endif // _TRACE_READER_H_
+
+/*****************************************************************************/